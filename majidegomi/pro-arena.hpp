@@ -0,0 +1,127 @@
+#ifndef PRO_ARENA_HPP
+#define PRO_ARENA_HPP
+#include <utility>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "pro.hpp"
+
+namespace pro {
+  // ノードを大きなブロックに詰めて確保するビルダー.
+  // ノードの参照カウントは program_t 自身が 1 つ持っているので 0 にならず, delete されない.
+  // ノードは program_t と一緒に消えるので, 木も eval の結果のクロージャも program_t より長生きさせてはいけない.
+  class program_t {
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    std::vector <std::unique_ptr <unsigned char []>> blocks;
+    std::vector <object_t *> nodes;
+    unsigned char * cursor;
+    std::size_t rest;
+    std::size_t used;
+
+    auto allocate (std::size_t size , std::size_t align) -> void * {
+      auto pad = (align - reinterpret_cast <std::uintptr_t> (cursor) % align) % align;
+      if (pad + size > rest) {
+        auto n = size + align > block_size ? size + align : block_size;
+        blocks.emplace_back (new unsigned char [n]);
+        cursor = blocks.back ().get ();
+        rest = n;
+        pad = (align - reinterpret_cast <std::uintptr_t> (cursor) % align) % align;
+      }
+      auto p = cursor + pad;
+      cursor += pad + size;
+      rest -= pad + size;
+      used += size;
+      return p;
+    }
+
+    template <typename T , typename ... Args>
+    auto make (Args && ... args) {
+      auto p = new (allocate (sizeof (T) , alignof (T))) T (std::forward <Args> (args) ...);
+      retain (p);
+      nodes.push_back (p);
+      return ref <T> {p};
+    }
+
+  public:
+    program_t ()
+      : blocks {}
+      , nodes {}
+      , cursor {nullptr}
+      , rest {0}
+      , used {0} {}
+
+    program_t (const program_t &) = delete;
+    auto operator = (const program_t &) -> program_t & = delete;
+
+    ~ program_t () {
+      for (auto ite = nodes.rbegin (); ite != nodes.rend (); ++ ite) {
+        (* ite) -> ~ object_t ();
+      }
+    }
+
+    auto node_count () const noexcept {
+      return nodes.size ();
+    }
+
+    auto bytes () const noexcept {
+      return used;
+    }
+
+    auto Void () {
+      return make <void_value_t> ();
+    }
+
+    auto Int (int_value_t::value_type && d) {
+      return make <int_value_t> (std::move (d));
+    }
+
+    auto Var (symbol n) {
+      return make <var_t> (n);
+    }
+
+    auto Var (const std::string & n) {
+      return Var (intern (n));
+    }
+
+    auto Lambda (lambda_t::arg_type && a , lambda_t::body_type && b) {
+      return make <lambda_t> (std::move (a) , std::move (b));
+    }
+
+    auto Apply (apply_t::func_type && f , apply_t::expr_type && e) {
+      return make <apply_t> (std::move (f) , std::move (e));
+    }
+
+    auto Let (expression && a , expression && e , expression && b) {
+      return Apply (Lambda (std::move (a) , std::move (b)) , std::move (e));
+    }
+
+    auto LetRec (expression && a , expression && e , letrec_t::body_type && b) {
+      return make <letrec_t> (std::move (a) , std::move (e) , std::move (b));
+    }
+
+    auto Prim (primitive op , prim_t::expr_type && l , prim_t::expr_type && r) {
+      return make <prim_t> (op , std::move (l) , std::move (r));
+    }
+
+    auto If (if_t::expr_type && t , if_t::expr_type && c , if_t::expr_type && a) {
+      return make <if_t> (std::move (t) , std::move (c) , std::move (a));
+    }
+
+    auto Case (match_t::expr_type && e , std::vector <clause_t> && cs) {
+      return make <match_t> (std::move (e) , std::move (cs));
+    }
+
+    auto Function (std::vector <clause_t> && cs) {
+      return Lambda (Var (detail::case_argument ()) , Case (Var (detail::case_argument ()) , std::move (cs)));
+    }
+
+    auto Tuple (std::vector <tuple_t::expr_type> && es) {
+      return make <tuple_t> (std::move (es));
+    }
+  };
+}
+
+#endif // PRO_ARENA_HPP
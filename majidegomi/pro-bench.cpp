@@ -0,0 +1,842 @@
+// g++ -std=c++14 -O2 -pthread pro-bench.cpp && ./a.out [section ...]
+// parallel は -DPRO_ATOMIC_REFCOUNT を付けたときだけ
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "pro.hpp"
+#include "pro-vm.hpp"
+#include "pro-machine.hpp"
+#include "pro-arena.hpp"
+#include "pro-optimize.hpp"
+#include "pro-scheduler.hpp"
+#include "pro-pool.hpp"
+#include "pro-hashcons.hpp"
+#include "pro-incremental.hpp"
+#include "pro-parser.hpp"
+#include "pro-image.hpp"
+#include "pro-fd.hpp"
+#ifdef PRO_ATOMIC_REFCOUNT
+#include "pro-parallel.hpp"
+#endif
+
+namespace bench {
+  std::size_t allocations = 0;
+}
+
+// 置き換えた operator new を malloc/free で実装しているのを GCC が誤検知する
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+auto operator new (std::size_t n) -> void * {
+  ++ bench::allocations;
+  if (auto p = std::malloc (n ? n : 1)) {
+    return p;
+  }
+  throw std::bad_alloc {};
+}
+
+auto operator delete (void * p) noexcept -> void {
+  std::free (p);
+}
+
+auto operator delete (void * p , std::size_t) noexcept -> void {
+  std::free (p);
+}
+
+namespace bench {
+  using clock_type = std::chrono::steady_clock;
+
+  // f を何回か回して 1 回あたりの最短時間 [us] を返す
+  template <typename F>
+  auto measure (F && f , int repeat = 5) {
+    auto best = 1e300;
+    for (int i = 0; i < repeat; ++ i) {
+      auto start = clock_type::now ();
+      f ();
+      std::chrono::duration <double , std::micro> d = clock_type::now () - start;
+      if (d.count () < best) {
+        best = d.count ();
+      }
+    }
+    return best;
+  }
+
+  // pro::Int などの自由関数をそのまま使うビルダー
+  struct heap_builder {
+    auto Int (pro::int_value_t::value_type && d) { return pro::Int (std::move (d)); }
+    auto Var (const std::string & n) { return pro::Var (n); }
+    auto Let (pro::expression && a , pro::expression && e , pro::expression && b) { return pro::Let (std::move (a) , std::move (e) , std::move (b)); }
+  };
+
+  // Let (x0 , 0 , Let (x1 , x0 , ... Var (x{n-1})))
+  template <typename Builder>
+  auto let_chain (Builder & b , int n) -> pro::expression {
+    pro::expression e = b.Var ("x" + std::to_string (n - 1));
+    for (int i = n - 1; i >= 0; -- i) {
+      pro::expression v = i == 0 ? pro::expression {b.Int (0)} : pro::expression {b.Var ("x" + std::to_string (i - 1))};
+      e = b.Let (b.Var ("x" + std::to_string (i)) , std::move (v) , std::move (e));
+    }
+    return e;
+  }
+
+  inline auto let_chain (int n) {
+    heap_builder b;
+    return let_chain (b , n);
+  }
+
+  inline auto let_scaling () {
+    for (int n = 256; n <= 4096; n *= 2) {
+      auto e = let_chain (n);
+      auto t = measure ([&] { pro::eval (pro::environ_t {} , e); });
+      std::cout << "  depth " << n << ": " << t << " us/eval, " << t * 1000 / n << " ns/level" << std::endl;
+    }
+  }
+
+  // Let (f , Lambda (x , Let (y , x , y)) , Apply (f , Apply (f , ... Int (0))))
+  inline auto apply_chain (int n) -> pro::expression {
+    pro::expression e = pro::Int (0);
+    for (int i = 0; i < n; ++ i) {
+      e = pro::Apply (pro::Var ("f") , std::move (e));
+    }
+    return pro::Let (pro::Var ("f") , pro::Lambda (pro::Var ("x") , pro::Let (pro::Var ("y") , pro::Var ("x") , pro::Var ("y"))) , std::move (e));
+  }
+
+  inline auto vm_vs_eval () {
+    auto compare = [] (const char * name , const pro::expression & e) {
+      auto code = pro::vm::compile (e);
+      auto te = measure ([&] { pro::eval (pro::environ_t {} , e); });
+      auto tv = measure ([&] { pro::vm::run (code); });
+      std::cout << "  " << name << ": eval " << te << " us, vm " << tv << " us (x" << te / tv << ")" << std::endl;
+    };
+    compare ("let-chain 1024" , let_chain (1024));
+    compare ("apply-chain 1024" , apply_chain (1024));
+  }
+
+  inline auto arena_build () {
+    for (int n = 1000; n <= 100000; n *= 10) {
+      auto count = allocations;
+      auto th = measure ([&] { let_chain (n); });
+      auto ah = (allocations - count) / 5;
+      count = allocations;
+      auto ta = measure ([&] { pro::program_t p; let_chain (p , n); });
+      auto aa = (allocations - count) / 5;
+      std::cout << "  let-chain " << n << ": heap " << th << " us, " << ah << " allocs; program_t " << ta << " us, " << aa << " allocs" << std::endl;
+    }
+  }
+
+  // 半分が失敗するパターンマッチ. 失敗の半分は型違い (Int に () など)
+  inline auto match_heavy () {
+    std::vector <std::pair <pro::expression , pro::expression>> cases;
+    for (int i = 0; i < 1000; ++ i) {
+      switch (i % 4) {
+        case 0: cases.emplace_back (pro::Int (i) , pro::Int (i)); break;
+        case 1: cases.emplace_back (pro::Void () , pro::Void ()); break;
+        case 2: cases.emplace_back (pro::Int (i) , pro::Int (i + 1)); break;
+        case 3: cases.emplace_back (pro::Int (i) , pro::Void ()); break;
+      }
+    }
+    std::vector <std::pair <pro::expression , pro::value_t>> values;
+    for (auto && c : cases) {
+      values.emplace_back (c.first , pro::eval (pro::environ_t {} , c.second));
+    }
+    auto matched = 0;
+    auto t = measure ([&] {
+      for (auto && c : values) {
+        pro::environ_t env;
+        matched += pro::pattern_match (c.first , c.second , env);
+      }
+    });
+    std::cout << "  1000 matches (500 fail): " << t << " us, " << t * 1000 / cases.size () << " ns/match" << std::endl;
+
+    // 同じ組を Lambda (pattern , ()) に適用する
+    std::vector <std::pair <pro::value_t , pro::value_t>> closures;
+    for (auto && c : values) {
+      auto f = pro::eval (pro::environ_t {} , pro::Lambda (pro::expression {c.first} , pro::Void ()));
+      closures.emplace_back (std::move (f) , c.second);
+    }
+    auto failed = 0;
+    t = measure ([&] {
+      for (auto && c : closures) {
+        failed += ! pro::apply (c.first , c.second);
+      }
+    });
+    std::cout << "  1000 applies (" << failed / 5 << " fail): " << t << " us, " << t * 1000 / closures.size () << " ns/apply" << std::endl;
+  }
+
+  // Let (f , id , Let (_ , f (f (... 0)) , Let (_ , ... , Int (1))))
+  // 束縛された値は一度も使われない
+  inline auto discarded_args (int n , int cost) -> pro::expression {
+    pro::expression e = pro::Int (1);
+    for (int i = 0; i < n; ++ i) {
+      pro::expression arg = pro::Int (0);
+      for (int j = 0; j < cost; ++ j) {
+        arg = pro::Apply (pro::Var ("f") , std::move (arg));
+      }
+      e = pro::Let (pro::Var ("_") , std::move (arg) , std::move (e));
+    }
+    return pro::Let (pro::Var ("f") , pro::Lambda (pro::Var ("x") , pro::Var ("x")) , std::move (e));
+  }
+
+  inline auto lazy_vs_strict () {
+    auto compare = [] (const char * name , const pro::expression & e) {
+      auto ts = measure ([&] { pro::run (pro::environ_t {} , e , pro::strategy::strict); });
+      auto tl = measure ([&] { pro::run (pro::environ_t {} , e , pro::strategy::lazy); });
+      std::cout << "  " << name << ": strict " << ts << " us, lazy " << tl << " us" << std::endl;
+    };
+    compare ("discarded 256 x 32" , discarded_args (256 , 32));
+    compare ("apply-chain 1024 (all used)" , apply_chain (1024));
+    compare ("let-chain 1024 (all used)" , let_chain (1024));
+  }
+
+  // n 個の束縛の奥で Lambda (_ , x0) を作って返す
+  inline auto closure_capture () {
+    for (int n = 100; n <= 10000; n *= 10) {
+      pro::expression e = pro::Lambda (pro::Var ("_") , pro::Var ("x0"));
+      for (int i = n - 1; i >= 0; -- i) {
+        e = pro::Let (pro::Var ("x" + std::to_string (i)) , pro::Int (i) , std::move (e));
+      }
+      auto t = measure ([&] { pro::eval (pro::environ_t {} , e); });
+      auto r = pro::eval (pro::environ_t {} , e);
+      auto c = r.get <pro::closure_t> ();
+      std::cout << "  " << n << " bindings: " << t << " us/eval, result captures " << c -> captured.size () << " value(s)" << std::endl;
+    }
+  }
+
+  // Let (x , Int (i) , Apply (Lambda (Int (i) , ...) , x)) を n 段. 整数を作って束縛して照合するだけ
+  inline auto int_chain (int n) -> pro::expression {
+    pro::expression e = pro::Var ("x");
+    for (int i = n - 1; i >= 0; -- i) {
+      e = pro::Let (pro::Var ("x") , pro::Int (i) , pro::Apply (pro::Lambda (pro::Int (i) , std::move (e)) , pro::Var ("x")));
+    }
+    return e;
+  }
+
+  inline auto int_heavy () {
+    auto e = int_chain (1000);
+    auto code = pro::vm::compile (e);
+    auto te = measure ([&] { pro::eval (pro::environ_t {} , e); });
+    auto tr = measure ([&] { pro::run (pro::environ_t {} , e); });
+    auto tv = measure ([&] { pro::vm::run (code); });
+    std::cout << "  int-chain 1000: eval " << te << " us, run " << tr << " us, vm " << tv << " us" << std::endl;
+  }
+
+  // サンク -> フレーム -> サンク の循環を作って捨てる. 参照カウントだけでは解放されない
+  inline auto make_cycle (int i) {
+    auto t = pro::make <pro::thunk_t> (pro::expression {pro::Int (i)} , pro::environ_t {});
+    t -> env = pro::extend (pro::environ_t {} , pro::intern ("self") , pro::value_t {t});
+  }
+
+  inline auto gc_cycles () {
+    auto t = measure ([] {
+      for (int i = 0; i < 1000000; ++ i) {
+        make_cycle (i);
+      }
+    } , 1);
+    std::cout << "  1000000 dropped cycles: " << t << " us, " << pro::traced_objects () << " objects still traced" << std::endl;
+    pro::collect ();
+    // 生きているフレームを n 個抱えたまま回収する. 辿る量は生きているオブジェクトの数に比例する
+    for (int n = 1000; n <= 100000; n *= 10) {
+      pro::environ_t env;
+      for (int i = 0; i < n; ++ i) {
+        env = pro::extend (env , pro::intern ("x") , pro::value_t::integer (i));
+      }
+      auto tc = measure ([] { pro::collect (); });
+      std::cout << "  collect with " << n << " live frames: " << tc << " us, " << tc * 1000 / n << " ns/object" << std::endl;
+    }
+  }
+
+  // 回数は Scott 符号化の自然数で数える (arith で整数の演算と比べる).
+  //   zero = λz. λs. z () , succ = λn. λz. λs. s n
+  // 10^k は Church 数の 10 を k 回合成して succ と zero に適用し, 実行時に作る
+  inline auto with_scott (int k , pro::expression && body) -> pro::expression {
+    pro::expression ten = pro::Var ("x");
+    for (int i = 0; i < 10; ++ i) {
+      ten = pro::Apply (pro::Var ("f") , std::move (ten));
+    }
+    pro::expression n = pro::Var ("succ");
+    for (int i = 0; i < k; ++ i) {
+      n = pro::Apply (pro::Var ("ten") , std::move (n));
+    }
+    return pro::Let (pro::Var ("zero") , pro::Lambda (pro::Var ("z") , pro::Lambda (pro::Var ("s") , pro::Apply (pro::Var ("z") , pro::Void ()))) ,
+      pro::Let (pro::Var ("succ") , pro::Lambda (pro::Var ("n") , pro::Lambda (pro::Var ("z") , pro::Lambda (pro::Var ("s") , pro::Apply (pro::Var ("s") , pro::Var ("n"))))) ,
+      pro::Let (pro::Var ("ten") , pro::Lambda (pro::Var ("f") , pro::Lambda (pro::Var ("x") , std::move (ten))) ,
+      pro::Let (pro::Var ("n") , pro::Apply (std::move (n) , pro::Var ("zero")) , std::move (body)))));
+  }
+
+  // λn. n (λ(). 0) (λm. self m)
+  inline auto count_down (const std::string & self) -> pro::expression {
+    return pro::Lambda (pro::Var ("n") , pro::Apply (pro::Apply (pro::Var ("n") , pro::Lambda (pro::Void () , pro::Int (0))) , pro::Lambda (pro::Var ("m") , pro::Apply (pro::Var (self) , pro::Var ("m")))));
+  }
+
+  inline auto letrec_loop (int k) {
+    return with_scott (k , pro::LetRec (pro::Var ("loop") , count_down ("loop") , pro::Apply (pro::Var ("loop") , pro::Var ("n"))));
+  }
+
+  // Z = λf. (λx. f (λv. x x v)) (λx. f (λv. x x v)). 一回りするたびにクロージャを作り直す
+  inline auto z_loop (int k) {
+    auto half = [] {
+      return pro::Lambda (pro::Var ("x") , pro::Apply (pro::Var ("f") , pro::Lambda (pro::Var ("v") , pro::Apply (pro::Apply (pro::Var ("x") , pro::Var ("x")) , pro::Var ("v")))));
+    };
+    auto z = pro::Lambda (pro::Var ("f") , pro::Apply (half () , half ()));
+    return with_scott (k , pro::Let (pro::Var ("loop") , pro::Apply (std::move (z) , pro::Lambda (pro::Var ("self") , count_down ("self"))) , pro::Apply (pro::Var ("loop") , pro::Var ("n"))));
+  }
+
+  inline auto recursion () {
+    auto compare = [] (int k) {
+      auto build = with_scott (k , pro::Int (0));
+      auto rec = letrec_loop (k);
+      auto z = z_loop (k);
+      auto bc = pro::vm::compile (build);
+      auto rc = pro::vm::compile (rec);
+      auto zc = pro::vm::compile (z);
+      auto n = 1.0;
+      for (int i = 0; i < k; ++ i) {
+        n *= 10;
+      }
+      // 数を作るだけの時間を引いて, 1 回りあたりにする
+      auto report = [&] (const char * name , double tb , double tr , double tz) {
+        std::cout << "  10^" << k << " " << name << ": build " << tb << " us, letrec +" << (tr - tb) * 1000 / n << " ns/iter, Z +" << (tz - tb) * 1000 / n << " ns/iter" << std::endl;
+      };
+      report ("eval" , measure ([&] { pro::eval (pro::environ_t {} , build); } , 3) , measure ([&] { pro::eval (pro::environ_t {} , rec); } , 3) , measure ([&] { pro::eval (pro::environ_t {} , z); } , 3));
+      report ("run" , measure ([&] { pro::run (pro::environ_t {} , build); } , 3) , measure ([&] { pro::run (pro::environ_t {} , rec); } , 3) , measure ([&] { pro::run (pro::environ_t {} , z); } , 3));
+      report ("vm" , measure ([&] { pro::vm::run (bc); } , 3) , measure ([&] { pro::vm::run (rc); } , 3) , measure ([&] { pro::vm::run (zc); } , 3));
+    };
+    compare (3);
+    compare (6);
+  }
+
+  inline auto optimizer () {
+    auto compare = [] (const char * name , const pro::expression & e) {
+      auto o = pro::optimize (e);
+      auto ec = pro::vm::compile (e);
+      auto oc = pro::vm::compile (o);
+      std::cout << "  " << name << ": " << pro::node_count (e) << " -> " << pro::node_count (o) << " nodes" << std::endl;
+      std::cout << "    eval " << measure ([&] { pro::eval (pro::environ_t {} , e); }) << " -> " << measure ([&] { pro::eval (pro::environ_t {} , o); }) << " us"
+        << ", run " << measure ([&] { pro::run (pro::environ_t {} , e); }) << " -> " << measure ([&] { pro::run (pro::environ_t {} , o); }) << " us"
+        << ", vm " << measure ([&] { pro::vm::run (ec); }) << " -> " << measure ([&] { pro::vm::run (oc); }) << " us" << std::endl;
+    };
+    compare ("let-chain 1024" , let_chain (1024));
+    compare ("int-chain 1000" , int_chain (1000));
+    compare ("apply-chain 1024" , apply_chain (1024));
+    compare ("letrec 10^3" , letrec_loop (3));
+    auto e = let_chain (1024);
+    std::cout << "  optimize let-chain 1024: " << measure ([&] { pro::optimize (e); }) << " us" << std::endl;
+  }
+
+  // λn. If (n , loop (n - 1) , 0)
+  inline auto int_loop (int k) -> pro::expression {
+    pro::int_value_t::value_type n = 1;
+    for (int i = 0; i < k; ++ i) {
+      n *= 10;
+    }
+    return pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::If (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Int (0))) , pro::Apply (pro::Var ("loop") , pro::Int (std::move (n))));
+  }
+
+  // fib n = If (n < 2 , n , fib (n - 1) + fib (n - 2))
+  inline auto fib (pro::int_value_t::value_type && n) -> pro::expression {
+    auto call = [] (pro::int_value_t::value_type && d) {
+      return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+    };
+    return pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) , pro::Apply (pro::Var ("fib") , pro::Int (std::move (n))));
+  }
+
+  inline auto native_fib (std::int64_t n) -> std::int64_t {
+    return n < 2 ? n : native_fib (n - 1) + native_fib (n - 2);
+  }
+
+  inline auto arithmetic () {
+    auto compare = [] (int k) {
+      auto build = with_scott (k , pro::Int (0));
+      auto scott = letrec_loop (k);
+      auto ints = int_loop (k);
+      auto bc = pro::vm::compile (build);
+      auto sc = pro::vm::compile (scott);
+      auto ic = pro::vm::compile (ints);
+      auto n = 1.0;
+      for (int i = 0; i < k; ++ i) {
+        n *= 10;
+      }
+      // Scott 数は作るだけの時間を引く
+      auto report = [&] (const char * name , double tb , double ts , double ti) {
+        std::cout << "  10^" << k << " " << name << ": scott +" << (ts - tb) * 1000 / n << " ns/iter, int " << ti * 1000 / n << " ns/iter" << std::endl;
+      };
+      report ("eval" , measure ([&] { pro::eval (pro::environ_t {} , build); } , 3) , measure ([&] { pro::eval (pro::environ_t {} , scott); } , 3) , measure ([&] { pro::eval (pro::environ_t {} , ints); } , 3));
+      report ("run" , measure ([&] { pro::run (pro::environ_t {} , build); } , 3) , measure ([&] { pro::run (pro::environ_t {} , scott); } , 3) , measure ([&] { pro::run (pro::environ_t {} , ints); } , 3));
+      report ("vm" , measure ([&] { pro::vm::run (bc); } , 3) , measure ([&] { pro::vm::run (sc); } , 3) , measure ([&] { pro::vm::run (ic); } , 3));
+    };
+    compare (3);
+    compare (6);
+
+    auto f = fib (25);
+    auto fc = pro::vm::compile (f);
+    volatile std::int64_t sink = 25;
+    std::cout << "  fib 25: eval " << measure ([&] { pro::eval (pro::environ_t {} , f); } , 3) << " us, run " << measure ([&] { pro::run (pro::environ_t {} , f); } , 3)
+      << " us, vm " << measure ([&] { pro::vm::run (fc); } , 3) << " us, native " << measure ([&] { sink = native_fib (sink); sink = 25; } , 3) << " us" << std::endl;
+  }
+
+  // 0 から n - 1 までの整数の節と, それ以外の節を持つ関数. chain は同じものを上から順に比べる If で書く
+  inline auto clauses (int n , bool chain) -> pro::expression {
+    auto arm = [] (int i) {
+      return pro::Int (pro::int_value_t::value_type {i * 3 + 1});
+    };
+    if (! chain) {
+      std::vector <pro::clause_t> cs;
+      for (int i = 0; i < n; ++ i) {
+        cs.push_back (pro::clause_t {pro::Int (pro::int_value_t::value_type {i}) , arm (i)});
+      }
+      cs.push_back (pro::clause_t {pro::Var ("k") , pro::Var ("k")});
+      return pro::Function (std::move (cs));
+    }
+    pro::expression e = pro::Var ("k");
+    for (int i = n - 1; i >= 0; -- i) {
+      e = pro::If (pro::Equal (pro::Var ("k") , pro::Int (pro::int_value_t::value_type {i})) , arm (i) , std::move (e));
+    }
+    return pro::Lambda (pro::Var ("k") , std::move (e));
+  }
+
+  // loop n acc = If (n , loop (n - 1) (acc + f (n % m)) , acc)
+  inline auto dispatch_loop (int n , bool chain , pro::int_value_t::value_type && k) -> pro::expression {
+    auto body = pro::If (pro::Var ("n") ,
+      pro::Apply (pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Add (pro::Var ("acc") , pro::Apply (pro::Var ("f") , pro::Mod (pro::Var ("n") , pro::Int (pro::int_value_t::value_type {n}))))) ,
+      pro::Var ("acc"));
+    return pro::Let (pro::Var ("f") , clauses (n , chain) ,
+      pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Lambda (pro::Var ("acc") , std::move (body))) ,
+      pro::Apply (pro::Apply (pro::Var ("loop") , pro::Int (std::move (k))) , pro::Int (0))));
+  }
+
+  inline auto case_dispatch () {
+    for (int n : {4 , 16 , 64}) {
+      auto tc = dispatch_loop (n , false , 1000);
+      auto ti = dispatch_loop (n , true , 1000);
+      auto c = dispatch_loop (n , false , 100000);
+      auto i = dispatch_loop (n , true , 100000);
+      auto cc = pro::vm::compile (c);
+      auto ic = pro::vm::compile (i);
+      std::cout << "  " << n << " clauses: eval case " << measure ([&] { pro::eval (pro::environ_t {} , tc); } , 3) << " us, if-chain " << measure ([&] { pro::eval (pro::environ_t {} , ti); } , 3) << " us (10^3)" << std::endl;
+      std::cout << "    run case " << measure ([&] { pro::run (pro::environ_t {} , c); } , 3) << " us, if-chain " << measure ([&] { pro::run (pro::environ_t {} , i); } , 3) << " us (10^5)" << std::endl;
+      std::cout << "    vm case " << measure ([&] { pro::vm::run (cc); } , 3) << " us, if-chain " << measure ([&] { pro::vm::run (ic); } , 3) << " us (10^5)" << std::endl;
+    }
+  }
+
+  // loop n acc = If (n , loop (n - 1) (acc + n) , acc)
+  inline auto sum_loop (pro::int_value_t::value_type && k) -> pro::expression {
+    auto body = pro::If (pro::Var ("n") , pro::Apply (pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Add (pro::Var ("acc") , pro::Var ("n"))) , pro::Var ("acc"));
+    return pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Lambda (pro::Var ("acc") , std::move (body))) , pro::Apply (pro::Apply (pro::Var ("loop") , pro::Int (std::move (k))) , pro::Int (0)));
+  }
+
+  // 止まらない式を先頭に混ぜた 1000 個の式を, 1 切れの長さを変えて回す.
+  // slice が無制限なら先に来た式を最後まで評価する (止まらない式は fuel で打ち切る)
+  inline auto scheduling () {
+    auto forever = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Var ("n"))) , pro::Apply (pro::Var ("loop") , pro::Int (0)));
+    std::vector <pro::expression> programs;
+    for (int i = 0; i < 1000; ++ i) {
+      programs.push_back (sum_loop (pro::int_value_t::value_type {100 + i * 37 % 2000}));
+    }
+    for (auto slice : {pro::scheduler::unlimited , std::size_t {100000} , std::size_t {1000}}) {
+      pro::scheduler s {slice};
+      for (int i = 0; i < 4; ++ i) {
+        s.spawn (pro::environ_t {} , forever , pro::strategy::strict , 2000000);
+      }
+      for (auto && e : programs) {
+        s.spawn (pro::environ_t {} , e);
+      }
+      auto start = clock_type::now ();
+      std::vector <double> slices;
+      auto finished = 0.0;
+      auto count = 0;
+      for (;;) {
+        auto before = s.pending ();
+        auto t0 = clock_type::now ();
+        if (! s.step ()) {
+          break;
+        }
+        auto t1 = clock_type::now ();
+        std::chrono::duration <double , std::micro> d = t1 - t0;
+        slices.push_back (d.count ());
+        if (s.pending () < before) {
+          std::chrono::duration <double , std::micro> f = t1 - start;
+          finished += f.count ();
+          ++ count;
+        }
+      }
+      std::chrono::duration <double , std::milli> total = clock_type::now () - start;
+      std::sort (slices.begin () , slices.end ());
+      std::cout << "  slice " << (slice == pro::scheduler::unlimited ? std::string {"unlimited"} : std::to_string (slice)) << ": total " << total.count () << " ms, mean completion " << finished / count / 1000 << " ms" << std::endl;
+      std::cout << "    per slice: p50 " << slices [slices.size () / 2] << " us, p99 " << slices [slices.size () * 99 / 100] << " us, max " << slices.back () << " us" << std::endl;
+    }
+  }
+
+  // fib (input) を凍結して, 入力の違う 2000 個のジョブをスレッドの数を変えて評価する
+  inline auto thread_pool () {
+    auto input = pro::intern ("input");
+    auto call = [] (pro::int_value_t::value_type && d) {
+      return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+    };
+    auto e = pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) , pro::Apply (pro::Var ("fib") , pro::Var (input)));
+    auto image = pro::vm::compile (e , input);
+    std::vector <pro::job_t> jobs;
+    for (int i = 0; i < 2000; ++ i) {
+      jobs.push_back (pro::job_t {& image , pro::value_t::integer (10 + i % 8)});
+    }
+    auto sequential = measure ([&] {
+      for (auto && j : jobs) {
+        pro::vm::run (image , j.input);
+      }
+    } , 3);
+    std::cout << "  " << std::thread::hardware_concurrency () << " hardware threads" << std::endl;
+    if (std::thread::hardware_concurrency () < 2) {
+      std::cout << "  (1 core: threads only take turns, so these numbers say nothing about scaling)" << std::endl;
+    }
+    std::cout << "  sequential: " << sequential << " us, " << jobs.size () / sequential * 1e6 << " jobs/s" << std::endl;
+    for (std::size_t n : {std::size_t {1} , std::size_t {2} , std::size_t {4} , std::size_t {8}}) {
+      pro::pool p {n};
+      auto t = measure ([&] { p.evaluate (jobs); } , 3);
+      std::cout << "  pool " << n << ": " << t << " us, " << jobs.size () / t * 1e6 << " jobs/s (x" << sequential / t << ")" << std::endl;
+    }
+  }
+
+  // 同じ形の閉じた部分式がたくさんある式. fib 14 をそれぞれ作った 32 個の和と,
+  // 本体で毎回 fib 12 を足すループを, そのままの木の eval と hashcons_t でまとめた木の memo_eval で比べる
+  inline auto sharing () {
+    auto fib = [] (pro::int_value_t::value_type && k) {
+      auto call = [] (pro::int_value_t::value_type && d) {
+        return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+      };
+      return pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) , pro::Apply (pro::Var ("fib") , pro::Int (std::move (k))));
+    };
+    pro::expression sum = fib (14);
+    for (int i = 1; i < 32; ++ i) {
+      sum = pro::Add (std::move (sum) , fib (14));
+    }
+    auto body = pro::If (pro::Var ("n") , pro::Apply (pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Add (pro::Var ("acc") , fib (12))) , pro::Var ("acc"));
+    pro::expression loop = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Lambda (pro::Var ("acc") , std::move (body))) , pro::Apply (pro::Apply (pro::Var ("loop") , pro::Int (1000)) , pro::Int (0)));
+    // 使い回せる部分式の無いループ. memo_eval の表を引く分だけ遅くなる
+    auto plain = sum_loop (10000);
+    for (auto && c : {std::make_pair ("32 x fib 14" , & sum) , std::make_pair ("loop 1000 + fib 12" , & loop) , std::make_pair ("sum loop 10^4" , & plain)}) {
+      auto & e = * c.second;
+      pro::hashcons_t h;
+      auto t_share = measure ([&] { pro::hashcons_t g; g.share (e); } , 3);
+      auto shared = h.share (e);
+      auto te = measure ([&] { pro::eval (pro::environ_t {} , e); } , 3);
+      auto tm = measure ([&] { pro::memo_t m; pro::memo_eval (m , pro::environ_t {} , shared); } , 3);
+      pro::memo_t m;
+      pro::memo_eval (m , pro::environ_t {} , shared);
+      std::cout << "  " << c.first << ": " << pro::node_count (e) << " -> " << h.node_count () << " nodes (share " << t_share << " us)" << std::endl;
+      std::cout << "    eval " << te << " us, memo_eval " << tm << " us (x" << te / tm << "), " << m.size () << " closed, " << m.misses () << " evaluated, " << m.hits () << " reused" << std::endl;
+    }
+  }
+
+  // x0 = fib, x_i = fib (12 + i % 4) + (前の束縛 1 つか定数) を 4000 個並べた Let の入れ子.
+  // 毎回 1% の束縛を差し替えて, 全体を eval し直すのと incremental_t で直すのを比べる
+  inline auto incremental () {
+    constexpr int n = 4000;
+    std::mt19937 random {1};
+    auto fib = [] {
+      auto call = [] (pro::int_value_t::value_type && d) {
+        return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+      };
+      return pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) , pro::Var ("fib"));
+    };
+    auto binding = [&] (int i , int k) -> pro::expression {
+      pro::expression other = pro::Int (k);
+      if (i > 1 && random () % 4 == 0) {
+        other = pro::Var ("x" + std::to_string (1 + random () % (i - 1)));
+      }
+      return pro::Add (pro::Apply (pro::Var ("x0") , pro::Int (12 + i % 4)) , std::move (other));
+    };
+    pro::expression e = pro::Var ("x" + std::to_string (n - 1));
+    for (int i = n - 1; i > 0; -- i) {
+      e = pro::Let (pro::Var ("x" + std::to_string (i)) , binding (i , i) , std::move (e));
+    }
+    e = pro::Let (pro::Var ("x0") , fib () , std::move (e));
+    pro::incremental_t inc {pro::environ_t {} , e};
+    auto first = measure ([&] { pro::incremental_t {pro::environ_t {} , e} .value (); } , 1);
+    inc.value ();
+    auto full = 0.0;
+    auto update = 0.0;
+    auto before = inc.evaluations ();
+    constexpr int rounds = 5;
+    for (int r = 0; r < rounds; ++ r) {
+      for (int c = 0; c < n / 100; ++ c) {
+        auto i = 1 + random () % (n - 1);
+        inc.rebind (i , binding (i , r * n + c));
+      }
+      update += measure ([&] { inc.value (); } , 1);
+      auto p = inc.program ();
+      full += measure ([&] { pro::eval (pro::environ_t {} , p); } , 1);
+      // 速さを測る前提が崩れているので, 続けずに落とす (確かめるのは pro-test-incremental.cpp)
+      if (pro::eval (pro::environ_t {} , p) .as_int () != inc.value () .as_int ()) {
+        throw std::runtime_error {"incremental value differs from eval."};
+      }
+    }
+    std::cout << "  " << n << " bindings, " << n / 100 << " replaced per round: first " << first << " us" << std::endl;
+    std::cout << "    eval " << full / rounds << " us, incremental " << update / rounds << " us (x" << full / update << "), " << (inc.evaluations () - before) / rounds << " bindings re-evaluated per round" << std::endl;
+  }
+
+  // (let v{i} (+ (* v{a} 3) (f v{b} 17)) ...) を n 個入れ子にしたソース. 名前は v0 .. v{names - 1} を使い回す
+  inline auto generated_source (int n , int names) -> std::string {
+    std::mt19937 random {1};
+    std::string s = "; generated\n(let f (lambda a (lambda b (- a b)))\n";
+    for (int i = 0; i < n; ++ i) {
+      auto a = i ? random () % i : 0;
+      auto b = i ? random () % i : 0;
+      s += "(let v" + std::to_string (i % names) + " (+ (* v" + std::to_string (a % names) + " 3) (f v" + std::to_string (b % names) + " 17))\n";
+    }
+    s += "v" + std::to_string ((n - 1) % names);
+    s.append (n + 1 , ')');
+    s += "\n";
+    return s;
+  }
+
+  // 生成した数 MB のソースを, メモリ上の文字列と mmap したファイルから読む速さ.
+  // 初めて見た名前だけ symbol 表を引くので, 名前の種類が多いほど遅い
+  inline auto parsing () {
+    char path [] = "/tmp/pro-bench-XXXXXX";
+    auto fd = ::mkstemp (path);
+    if (fd < 0) {
+      std::cout << "  cannot create a temporary file" << std::endl;
+      return;
+    }
+    ::close (fd);
+    for (auto && c : {std::make_pair (10000 , 1000) , std::make_pair (200000 , 1000) , std::make_pair (200000 , 200000)}) {
+      auto source = generated_source (c.first , c.second);
+      std::ofstream {path} << source;
+      auto mb = source.size () / 1e6;
+      std::size_t nodes = 0;
+      auto count = allocations;
+      auto tm = measure ([&] { pro::program_t p; pro::parse (p , source); nodes = p.node_count (); } , 3);
+      auto am = (allocations - count) / 3;
+      auto tf = measure ([&] { pro::program_t p; pro::parse_file (p , path); } , 3);
+      auto th = measure ([&] { pro::hashcons_t h; pro::parse (h , source); } , 3);
+      std::cout << "  " << mb << " MB, " << c.second << " names, " << nodes << " nodes: memory " << mb / tm * 1e6 << " MB/s, mmap " << mb / tf * 1e6 << " MB/s, hashcons_t " << mb / th * 1e6 << " MB/s" << std::endl;
+      std::cout << "    " << nodes / tm << " nodes/us, " << am / mb << " allocations/MB (program_t)" << std::endl;
+    }
+    ::unlink (path);
+  }
+
+  // 生成したソースを読んでコンパイルするのと, コンパイル済みの像を mmap するのを比べる.
+  // compile は再帰で木を辿るので, 束縛の数はスタックに収まるところまで
+  inline auto image_loading () {
+    char path [] = "/tmp/pro-bench-XXXXXX";
+    auto fd = ::mkstemp (path);
+    if (fd < 0) {
+      std::cout << "  cannot create a temporary file" << std::endl;
+      return;
+    }
+    ::close (fd);
+    for (auto n : {1000 , 20000}) {
+      // 最初の束縛が v0 を見るので外で束縛しておく
+      auto source = "(let v0 1\n" + generated_source (n , 1000) + ")";
+      pro::program_t p;
+      auto code = pro::vm::compile (pro::parse (p , source));
+      pro::vm::save (code , path);
+      auto bytes = pro::vm::serialize (code).size ();
+      auto count = allocations;
+      auto tc = measure ([&] { pro::program_t q; pro::vm::compile (pro::parse (q , source)); } , 3);
+      auto ac = (allocations - count) / 3;
+      count = allocations;
+      auto tl = measure ([&] { pro::vm::mapped_image m {path}; } , 3);
+      auto al = (allocations - count) / 3;
+      pro::vm::mapped_image m {path};
+      auto tr = measure ([&] { pro::vm::run (code); } , 3);
+      auto ti = measure ([&] { pro::vm::run (m.view ()); } , 3);
+      std::cout << "  " << n << " bindings, " << code.code.size () << " instructions, image " << bytes / 1e6 << " MB" << std::endl;
+      std::cout << "    parse + compile " << tc << " us (" << ac << " allocations), mmap + check " << tl << " us (" << al << " allocations, x" << tc / tl << ")" << std::endl;
+      std::cout << "    run code_t " << tr << " us, run image " << ti << " us" << std::endl;
+    }
+    ::unlink (path);
+  }
+
+  // 10^6 個の値を書き出す. 値ごとに stringstream を作る前の show と, 1 つのバッファや fd に書く show_to を比べる
+  inline auto showing () {
+    std::mt19937_64 random {1};
+    std::vector <pro::value_t> values;
+    for (int i = 0; i < 1000000; ++ i) {
+      auto r = random ();
+      values.push_back (r % 16 == 0 ? pro::value_t {} : pro::value_t::integer (static_cast <std::int64_t> (r) >> (r % 64)));
+    }
+    std::size_t bytes = 0;
+    auto count = allocations;
+    auto ts = measure ([&] {
+      std::string out;
+      for (auto && v : values) {
+        std::stringstream ss;
+        if (v.is_void ()) {
+          ss << "()";
+        }
+        else {
+          ss << v.as_int ();
+        }
+        out += ss.str ();
+        out += '\n';
+      }
+      bytes = out.size ();
+    } , 3);
+    auto as = (allocations - count) / 3;
+    count = allocations;
+    auto tv = measure ([&] {
+      std::string out;
+      for (auto && v : values) {
+        out += pro::show (v);
+        out += '\n';
+      }
+    } , 3);
+    auto av = (allocations - count) / 3;
+    count = allocations;
+    auto tb = measure ([&] {
+      std::string out;
+      for (auto && v : values) {
+        pro::show_to (out , v);
+        out += '\n';
+      }
+    } , 3);
+    auto ab = (allocations - count) / 3;
+    auto fd = ::open ("/dev/null" , O_WRONLY);
+    count = allocations;
+    auto tf = measure ([&] {
+      pro::fd_sink out {fd};
+      for (auto && v : values) {
+        pro::show_to (out , v);
+        out.append ("\n" , 1);
+      }
+    } , 3);
+    auto af = (allocations - count) / 3;
+    ::close (fd);
+    std::cout << "  " << values.size () << " values, " << bytes / 1e6 << " MB" << std::endl;
+    std::cout << "    stringstream per value " << ts << " us (" << as << " allocations)" << std::endl;
+    std::cout << "    show per value " << tv << " us (" << av << " allocations)" << std::endl;
+    std::cout << "    show_to one string " << tb << " us (" << ab << " allocations)" << std::endl;
+    std::cout << "    show_to fd_sink /dev/null " << tf << " us (" << af << " allocations)" << std::endl;
+  }
+
+  // n 要素の列をクロージャの cons セル, タプルの cons セル, 永続ベクタで作って足し上げる (VM で末尾呼び出し).
+  // ベクタは 32 要素ずつ連続した配列なので, 1 要素あたりの確保もポインタを辿る回数も少ない
+  inline auto tuples () {
+    auto n = std::to_string (100000);
+    const char * sum = "(letrec sum (lambda l (lambda acc ";
+    struct variant {
+      const char * name;
+      std::string source;
+    } variants [] = {
+      {"closure cons" ,
+        "(let cons (lambda h (lambda t (lambda k ((k h) t))))"
+        " (letrec build (lambda n (lambda acc (if (== n 0) acc ((build (- n 1)) ((cons n) acc)))))"
+        + std::string {sum} + "(case l (() acc) (c (c (lambda h (lambda t ((sum t) (+ acc h)))))))))"
+        " ((sum ((build " + n + ") ())) 0))))"} ,
+      {"tuple cons" ,
+        "(letrec build (lambda n (lambda acc (if (== n 0) acc ((build (- n 1)) (tuple n acc)))))"
+        + std::string {sum} + "(case l (() acc) (c (let (tuple h t) c ((sum t) (+ acc h)))))))"
+        " ((sum ((build " + n + ") ())) 0)))"} ,
+      {"vector push + index" ,
+        "(letrec build (lambda n (lambda acc (if (== n 0) acc ((build (- n 1)) (push acc n)))))"
+        " (let v ((build " + n + ") (tuple))"
+        + std::string {sum} + "(if (== l (size v)) acc ((sum (+ l 1)) (+ acc (index v l))))))"
+        " ((sum 0) 0))))"} ,
+      {"vector update" ,
+        "(letrec build (lambda n (lambda acc (if (== n 0) acc ((build (- n 1)) (push acc n)))))"
+        " (letrec fill (lambda i (lambda v (if (== i (size v)) (index v 0) ((fill (+ i 1)) (update v i i)))))"
+        " ((fill 0) ((build " + n + ") (tuple)))))"} ,
+    };
+    std::cout << "  " << n << " elements" << std::endl;
+    for (auto && v : variants) {
+      pro::program_t p;
+      auto code = pro::vm::compile (pro::parse (p , v.source));
+      pro::value_t result;
+      auto count = allocations;
+      auto t = measure ([&] { result = pro::vm::run (code); } , 3);
+      auto a = (allocations - count) / 3;
+      std::cout << "    " << v.name << ": " << t << " us (" << a << " allocations) = " << pro::show (result) << std::endl;
+    }
+  }
+
+#ifdef PRO_ATOMIC_REFCOUNT
+  // fib 24 と, fib 16 を 64 個足す平たい木を eval と parallel_eval で比べる
+  inline auto parallel () {
+    auto fib_lambda = [] {
+      auto call = [] (pro::int_value_t::value_type && d) {
+        return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+      };
+      return pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2))));
+    };
+    auto deep = pro::LetRec (pro::Var ("fib") , fib_lambda () , pro::Apply (pro::Var ("fib") , pro::Int (24)));
+    std::vector <pro::expression> leaves;
+    for (int i = 0; i < 64; ++ i) {
+      leaves.push_back (pro::Apply (pro::Var ("fib") , pro::Int (16)));
+    }
+    while (leaves.size () > 1) {
+      std::vector <pro::expression> next;
+      for (std::size_t i = 0; i < leaves.size (); i += 2) {
+        next.push_back (pro::Add (std::move (leaves [i]) , std::move (leaves [i + 1])));
+      }
+      leaves = std::move (next);
+    }
+    auto wide = pro::LetRec (pro::Var ("fib") , fib_lambda () , std::move (leaves.front ()));
+    std::cout << "  " << std::thread::hardware_concurrency () << " hardware threads" << std::endl;
+    if (std::thread::hardware_concurrency () < 2) {
+      std::cout << "  (1 core: threads only take turns, so these numbers say nothing about scaling)" << std::endl;
+    }
+    for (auto && c : {std::make_pair ("fib 24" , & deep) , std::make_pair ("64 x fib 16" , & wide)}) {
+      auto & e = * c.second;
+      auto sequential = measure ([&] { pro::eval (pro::environ_t {} , e); } , 3);
+      std::cout << "  " << c.first << ": eval " << sequential << " us" << std::endl;
+      for (std::size_t n : {std::size_t {1} , std::size_t {2} , std::size_t {4}}) {
+        pro::fork_join_pool p {n};
+        auto t = measure ([&] { pro::parallel_eval (p , pro::environ_t {} , e); } , 3);
+        std::cout << "    parallel " << n << ": " << t << " us (x" << sequential / t << ")" << std::endl;
+      }
+    }
+  }
+#endif
+
+  struct section {
+    const char * name;
+    void (* run) ();
+  };
+
+  const section sections [] = {
+    {"let-scaling" , let_scaling} ,
+    {"vm" , vm_vs_eval} ,
+    {"arena" , arena_build} ,
+    {"match" , match_heavy} ,
+    {"lazy" , lazy_vs_strict} ,
+    {"closure" , closure_capture} ,
+    {"int" , int_heavy} ,
+    {"gc" , gc_cycles} ,
+    {"letrec" , recursion} ,
+    {"optimize" , optimizer} ,
+    {"arith" , arithmetic} ,
+    {"case" , case_dispatch} ,
+    {"sched" , scheduling} ,
+    {"pool" , thread_pool} ,
+    {"share" , sharing} ,
+    {"incremental" , incremental} ,
+    {"parse" , parsing} ,
+    {"image" , image_loading} ,
+    {"show" , showing} ,
+    {"tuple" , tuples} ,
+#ifdef PRO_ATOMIC_REFCOUNT
+    {"parallel" , parallel} ,
+#endif
+  };
+}
+
+auto main (int argc , char ** argv) -> int {
+  for (auto && s : bench::sections) {
+    auto selected = argc < 2;
+    for (int i = 1; i < argc; ++ i) {
+      selected = selected || std::strcmp (argv [i] , s.name) == 0;
+    }
+    if (selected) {
+      std::cout << s.name << std::endl;
+      s.run ();
+    }
+  }
+}
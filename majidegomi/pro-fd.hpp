@@ -0,0 +1,70 @@
+#ifndef PRO_FD_HPP
+#define PRO_FD_HPP
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+
+namespace pro {
+  // ファイル記述子に書く show_to の sink. 溜めてからまとめて write する.
+  // バッファより大きいものは溜めずにそのまま書く. fd は閉じない
+  class fd_sink {
+    int fd;
+    std::vector <char> buffer;
+    std::size_t used;
+
+    auto write_all (const char * p , std::size_t n) -> void {
+      while (n != 0) {
+        auto r = ::write (fd , p , n);
+        if (r < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw std::runtime_error {"cannot write to fd " + std::to_string (fd) + ": " + std::strerror (errno)};
+        }
+        p += r;
+        n -= static_cast <std::size_t> (r);
+      }
+    }
+
+  public:
+    explicit fd_sink (int f , std::size_t capacity = 1 << 16)
+      : fd {f}
+      , buffer (capacity == 0 ? 1 : capacity)
+      , used {0} {}
+
+    fd_sink (const fd_sink &) = delete;
+    auto operator = (const fd_sink &) -> fd_sink & = delete;
+
+    // 書けなかったときに投げるので, 例外を見たければ自分で flush を呼ぶこと
+    ~ fd_sink () {
+      try {
+        flush ();
+      }
+      catch (...) {}
+    }
+
+    auto append (const char * p , std::size_t n) -> void {
+      if (n > buffer.size () - used) {
+        flush ();
+        if (n >= buffer.size ()) {
+          write_all (p , n);
+          return;
+        }
+      }
+      std::memcpy (buffer.data () + used , p , n);
+      used += n;
+    }
+
+    auto flush () -> void {
+      auto n = used;
+      used = 0;
+      write_all (buffer.data () , n);
+    }
+  };
+}
+
+#endif // PRO_FD_HPP
@@ -0,0 +1,514 @@
+#ifndef PRO_HASHCONS_HPP
+#define PRO_HASHCONS_HPP
+#include <utility>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include "pro.hpp"
+
+// 構造が同じ部分木を 1 つのノードにまとめるビルダーと, 自由変数の無い部分式の値を覚えておく評価器.
+// 式は書き換えないので, 同じノードをいくつの親が指していても eval の結果は変わらない.
+namespace pro {
+  // 子はノードの同一性で比べるので, 子もこのビルダーで作ったものなら木全体がまとまる.
+  // 表がノードの参照を 1 つずつ持つので, 作ったノードは hashcons_t より長生きする
+  class hashcons_t {
+    using key_type = std::vector <std::uint64_t>;
+
+    struct key_hash {
+      auto operator () (const key_type & k) const noexcept -> std::size_t {
+        std::uint64_t h = 0xcbf29ce484222325u;
+        for (auto w : k) {
+          h = (h ^ w) * 0x100000001b3u;
+          h ^= h >> 29;
+        }
+        return static_cast <std::size_t> (h);
+      }
+    };
+
+    enum class kind : std::uint64_t {
+      void_value ,
+      int_value ,
+      var ,
+      lambda ,
+      apply ,
+      letrec ,
+      prim ,
+      if_ ,
+      match ,
+      tuple ,
+    };
+
+    std::unordered_map <key_type , expression , key_hash> table;
+    std::size_t hit;
+
+    static auto word (const expression & e) {
+      return static_cast <std::uint64_t> (reinterpret_cast <std::uintptr_t> (detail::node_of (e)));
+    }
+
+    // 同じ key のノードがあればそれを返す. 無ければ build () で作って覚える
+    template <typename T , typename F>
+    auto find_or_make (key_type && key , F && build) -> ref <T> {
+      auto ite = table.find (key);
+      if (ite != table.end ()) {
+        ++ hit;
+        return boost::get <ref <T>> (ite -> second);
+      }
+      auto p = build ();
+      table.emplace (std::move (key) , expression {p});
+      return p;
+    }
+
+  public:
+    hashcons_t ()
+      : table {}
+      , hit {0} {}
+
+    hashcons_t (const hashcons_t &) = delete;
+    auto operator = (const hashcons_t &) -> hashcons_t & = delete;
+
+    // 作ったノードの数
+    auto node_count () const noexcept {
+      return table.size ();
+    }
+
+    // 作らずに済んだ回数
+    auto hits () const noexcept {
+      return hit;
+    }
+
+    auto Void () {
+      return find_or_make <void_value_t> ({static_cast <std::uint64_t> (kind::void_value)} , [] {
+        return pro::Void ();
+      });
+    }
+
+    auto Int (int_value_t::value_type && d) {
+      auto k = static_cast <std::uint64_t> (d);
+      return find_or_make <int_value_t> ({static_cast <std::uint64_t> (kind::int_value) , k} , [&] {
+        return pro::Int (std::move (d));
+      });
+    }
+
+    auto Var (symbol n) {
+      return find_or_make <var_t> ({static_cast <std::uint64_t> (kind::var) , n.id} , [&] {
+        return pro::Var (n);
+      });
+    }
+
+    auto Var (const std::string & n) {
+      return Var (pro::intern (n));
+    }
+
+    auto Lambda (lambda_t::arg_type && a , lambda_t::body_type && b) {
+      return find_or_make <lambda_t> ({static_cast <std::uint64_t> (kind::lambda) , word (a) , word (b)} , [&] {
+        return pro::Lambda (std::move (a) , std::move (b));
+      });
+    }
+
+    auto Apply (apply_t::func_type && f , apply_t::expr_type && e) {
+      return find_or_make <apply_t> ({static_cast <std::uint64_t> (kind::apply) , word (f) , word (e)} , [&] {
+        return pro::Apply (std::move (f) , std::move (e));
+      });
+    }
+
+    auto Let (expression && a , expression && e , expression && b) {
+      return Apply (Lambda (std::move (a) , std::move (b)) , std::move (e));
+    }
+
+    auto LetRec (expression && a , expression && e , letrec_t::body_type && b) {
+      return find_or_make <letrec_t> ({static_cast <std::uint64_t> (kind::letrec) , word (a) , word (e) , word (b)} , [&] {
+        return pro::LetRec (std::move (a) , std::move (e) , std::move (b));
+      });
+    }
+
+    auto Prim (primitive op , prim_t::expr_type && l , prim_t::expr_type && r) {
+      return find_or_make <prim_t> ({static_cast <std::uint64_t> (kind::prim) , static_cast <std::uint64_t> (op) , word (l) , word (r)} , [&] {
+        return pro::Prim (op , std::move (l) , std::move (r));
+      });
+    }
+
+    auto If (if_t::expr_type && t , if_t::expr_type && c , if_t::expr_type && a) {
+      return find_or_make <if_t> ({static_cast <std::uint64_t> (kind::if_) , word (t) , word (c) , word (a)} , [&] {
+        return pro::If (std::move (t) , std::move (c) , std::move (a));
+      });
+    }
+
+    auto Case (match_t::expr_type && e , std::vector <clause_t> && cs) {
+      key_type key {static_cast <std::uint64_t> (kind::match) , word (e)};
+      for (auto && c : cs) {
+        key.push_back (word (c.pattern));
+        key.push_back (word (c.body));
+      }
+      return find_or_make <match_t> (std::move (key) , [&] {
+        return pro::Case (std::move (e) , std::move (cs));
+      });
+    }
+
+    auto Function (std::vector <clause_t> && cs) {
+      return Lambda (Var (detail::case_argument ()) , Case (Var (detail::case_argument ()) , std::move (cs)));
+    }
+
+    auto Tuple (std::vector <tuple_t::expr_type> && es) {
+      key_type key {static_cast <std::uint64_t> (kind::tuple)};
+      for (auto && e : es) {
+        key.push_back (word (e));
+      }
+      return find_or_make <tuple_t> (std::move (key) , [&] {
+        return pro::Tuple (std::move (es));
+      });
+    }
+
+    // 他で作った木をこのビルダーで作り直す. 深い木でも再帰しないよう後行順に明示的なスタックで辿る
+    auto share (const expression & root) -> expression {
+      std::unordered_map <const object_t * , expression> done;
+      auto of = [&] (const expression & e) {
+        return done.at (detail::node_of (e));
+      };
+      std::vector <std::pair <const expression * , bool>> work {{& root , false}};
+      while (! work.empty ()) {
+        auto w = work.back ();
+        work.pop_back ();
+        auto & e = * w.first;
+        if (done.count (detail::node_of (e))) {
+          continue;
+        }
+        std::vector <const expression *> children;
+        if (auto l = boost::get <ref <lambda_t>> (& e)) {
+          children = {& (* l) -> arg , & (* l) -> body};
+        }
+        else if (auto a = boost::get <ref <apply_t>> (& e)) {
+          children = {& (* a) -> func , & (* a) -> expr};
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (& e)) {
+          // 関数のラムダは expression に入っていないので, その引数と本体を直接辿る
+          children = {& (* r) -> func -> arg , & (* r) -> func -> body , & (* r) -> body};
+        }
+        else if (auto o = boost::get <ref <prim_t>> (& e)) {
+          children = {& (* o) -> lhs , & (* o) -> rhs};
+        }
+        else if (auto i = boost::get <ref <if_t>> (& e)) {
+          children = {& (* i) -> test , & (* i) -> consequent , & (* i) -> alternative};
+        }
+        else if (auto m = boost::get <ref <match_t>> (& e)) {
+          children.push_back (& (* m) -> scrutinee);
+          for (auto && c : (* m) -> clauses) {
+            children.push_back (& c.pattern);
+            children.push_back (& c.body);
+          }
+        }
+        else if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          for (auto && x : (* t) -> elements) {
+            children.push_back (& x);
+          }
+        }
+        if (! w.second && ! children.empty ()) {
+          work.emplace_back (& e , true);
+          for (auto c : children) {
+            work.emplace_back (c , false);
+          }
+          continue;
+        }
+        auto rebuild = [&] () -> expression {
+          if (auto n = boost::get <ref <int_value_t>> (& e)) {
+            return Int (int_value_t::value_type {(* n) -> data});
+          }
+          if (auto x = boost::get <ref <var_t>> (& e)) {
+            return Var ((* x) -> name);
+          }
+          if (auto l = boost::get <ref <lambda_t>> (& e)) {
+            return Lambda (of ((* l) -> arg) , of ((* l) -> body));
+          }
+          if (auto a = boost::get <ref <apply_t>> (& e)) {
+            return Apply (of ((* a) -> func) , of ((* a) -> expr));
+          }
+          if (auto r = boost::get <ref <letrec_t>> (& e)) {
+            auto & f = (* r) -> func;
+            return LetRec (Var ((* r) -> name) , Lambda (of (f -> arg) , of (f -> body)) , of ((* r) -> body));
+          }
+          if (auto o = boost::get <ref <prim_t>> (& e)) {
+            return Prim ((* o) -> op , of ((* o) -> lhs) , of ((* o) -> rhs));
+          }
+          if (auto i = boost::get <ref <if_t>> (& e)) {
+            return If (of ((* i) -> test) , of ((* i) -> consequent) , of ((* i) -> alternative));
+          }
+          if (auto m = boost::get <ref <match_t>> (& e)) {
+            std::vector <clause_t> cs;
+            for (auto && c : (* m) -> clauses) {
+              cs.push_back ({of (c.pattern) , of (c.body)});
+            }
+            return Case (of ((* m) -> scrutinee) , std::move (cs));
+          }
+          if (auto t = boost::get <ref <tuple_t>> (& e)) {
+            std::vector <expression> es;
+            for (auto && x : (* t) -> elements) {
+              es.push_back (of (x));
+            }
+            return Tuple (std::move (es));
+          }
+          return Void ();
+        };
+        done.emplace (detail::node_of (e) , rebuild ());
+      }
+      return of (root);
+    }
+  };
+
+
+  namespace detail {
+    struct memo_f;
+  }
+
+  // 自由変数の無い部分式の値. 式は純粋なので, そういう部分式は環境によらず毎回同じ値になる.
+  // 関数の本体の中にあっても, 呼び出しごとでなくプログラム全体で 1 回だけ評価する.
+  // 覚えるのは成功した値だけ. 失敗した部分式はもう一度評価して同じ例外を投げ直す
+  class memo_t {
+    struct entry {
+      // 表のキーのアドレスが別のノードに使い回されないよう, ノードを持っておく
+      expression node;
+      value_t value;
+      bool known;
+    };
+
+    std::unordered_map <const object_t * , entry> closed;
+    std::size_t hit;
+    std::size_t miss;
+
+    friend struct detail::memo_f;
+
+  public:
+    memo_t ()
+      : closed {}
+      , hit {0}
+      , miss {0} {}
+
+    memo_t (const memo_t &) = delete;
+    auto operator = (const memo_t &) -> memo_t & = delete;
+
+    // e の中の, 評価する価値のある (適用, letrec, 演算, If, Case, タプル) 閉じた部分式を表に載せる.
+    // ベクタは変わらないので, 閉じたタプルは 1 つのベクタを皆で共有する.
+    // 各ノードの自由変数を後行順に求める. 共有されたノードは一度だけ調べる.
+    // ラムダの自由変数は作ったときに求めた free を使う
+    auto prepare (const expression & root) -> void {
+      std::unordered_map <const object_t * , std::vector <symbol>> free;
+      auto of = [&] (const expression & e) -> const std::vector <symbol> & {
+        static const std::vector <symbol> none {};
+        auto ite = free.find (detail::node_of (e));
+        return ite == free.end () ? none : ite -> second;
+      };
+      // hidden は束縛されて見えなくなる名前. 無ければ nullptr
+      auto merge = [] (std::vector <symbol> & out , const std::vector <symbol> & xs , const symbol * hidden) {
+        for (auto x : xs) {
+          if (! hidden || x != * hidden) {
+            out.push_back (x);
+          }
+        }
+      };
+      std::vector <std::pair <const expression * , bool>> work {{& root , false}};
+      while (! work.empty ()) {
+        auto w = work.back ();
+        work.pop_back ();
+        auto & e = * w.first;
+        auto n = detail::node_of (e);
+        if (free.count (n) || closed.count (n)) {
+          continue;
+        }
+        std::vector <const expression *> children;
+        if (auto l = boost::get <ref <lambda_t>> (& e)) {
+          children = {& (* l) -> body};
+        }
+        else if (auto a = boost::get <ref <apply_t>> (& e)) {
+          children = {& (* a) -> func , & (* a) -> expr};
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (& e)) {
+          children = {& (* r) -> func -> body , & (* r) -> body};
+        }
+        else if (auto o = boost::get <ref <prim_t>> (& e)) {
+          children = {& (* o) -> lhs , & (* o) -> rhs};
+        }
+        else if (auto i = boost::get <ref <if_t>> (& e)) {
+          children = {& (* i) -> test , & (* i) -> consequent , & (* i) -> alternative};
+        }
+        else if (auto m = boost::get <ref <match_t>> (& e)) {
+          children.push_back (& (* m) -> scrutinee);
+          for (auto && c : (* m) -> clauses) {
+            children.push_back (& c.body);
+          }
+        }
+        else if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          for (auto && x : (* t) -> elements) {
+            children.push_back (& x);
+          }
+        }
+        if (! w.second && ! children.empty ()) {
+          work.emplace_back (& e , true);
+          for (auto c : children) {
+            work.emplace_back (c , false);
+          }
+          continue;
+        }
+        std::vector <symbol> fv;
+        bool worth = true;
+        if (auto x = boost::get <ref <var_t>> (& e)) {
+          fv.push_back ((* x) -> name);
+          worth = false;
+        }
+        else if (auto l = boost::get <ref <lambda_t>> (& e)) {
+          fv = free_variables (* l);
+          worth = false;
+        }
+        else if (auto a = boost::get <ref <apply_t>> (& e)) {
+          merge (fv , of ((* a) -> func) , nullptr);
+          merge (fv , of ((* a) -> expr) , nullptr);
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (& e)) {
+          merge (fv , free_variables ((* r) -> func) , & (* r) -> name);
+          merge (fv , of ((* r) -> body) , & (* r) -> name);
+        }
+        else if (auto o = boost::get <ref <prim_t>> (& e)) {
+          merge (fv , of ((* o) -> lhs) , nullptr);
+          merge (fv , of ((* o) -> rhs) , nullptr);
+        }
+        else if (auto i = boost::get <ref <if_t>> (& e)) {
+          merge (fv , of ((* i) -> test) , nullptr);
+          merge (fv , of ((* i) -> consequent) , nullptr);
+          merge (fv , of ((* i) -> alternative) , nullptr);
+        }
+        else if (auto m = boost::get <ref <match_t>> (& e)) {
+          merge (fv , of ((* m) -> scrutinee) , nullptr);
+          for (std::uint32_t j = 0; j < (* m) -> clauses.size (); ++ j) {
+            auto x = (* m) -> binder (j);
+            merge (fv , of ((* m) -> clauses [j].body) , x ? & x -> name : nullptr);
+          }
+        }
+        else if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          for (auto && x : (* t) -> elements) {
+            merge (fv , of (x) , nullptr);
+          }
+        }
+        else {
+          worth = false;
+        }
+        std::sort (fv.begin () , fv.end () , detail::symbol_less);
+        fv.erase (std::unique (fv.begin () , fv.end ()) , fv.end ());
+        if (fv.empty () && worth) {
+          closed.emplace (n , entry {e , value_t {} , false});
+        }
+        free.emplace (n , std::move (fv));
+      }
+    }
+
+    // 表に載った閉じた部分式の数
+    auto size () const noexcept {
+      return closed.size ();
+    }
+
+    // 覚えた値を使えた回数
+    auto hits () const noexcept {
+      return hit;
+    }
+
+    // 閉じた部分式を実際に評価した回数
+    auto misses () const noexcept {
+      return miss;
+    }
+
+    // 覚えた値を捨てる. 表に載った部分式はそのまま
+    auto forget () -> void {
+      for (auto && c : closed) {
+        c.second.value = value_t {};
+        c.second.known = false;
+      }
+    }
+  };
+
+  namespace detail {
+    // eval_tail に渡して, 閉じた部分式で表を引く. 末尾位置は eval と同じループで続けるので, ネイティブスタックは伸びない.
+    // 関数の本体もこれで評価するので, 呼ばれた先の閉じた部分式も覚えられる
+    struct memo_f {
+      memo_t & memo;
+
+      auto operator () (const environ_t & env , const expression & e) const -> value_t {
+        value_t v;
+        if (known (e , v)) {
+          return v;
+        }
+        return boost::apply_visitor ([&] (const auto & p) {
+          return (* this) (env , p);
+        } , e);
+      }
+
+      // 閉じた部分式なら, 覚えた値を使うか評価して覚える
+      auto known (const expression & e , value_t & v) const -> bool {
+        auto ite = memo.closed.find (detail::node_of (e));
+        if (ite == memo.closed.end ()) {
+          return false;
+        }
+        if (ite -> second.known) {
+          ++ memo.hit;
+          v = ite -> second.value;
+          return true;
+        }
+        ++ memo.miss;
+        // 閉じているので環境は要らない. 評価中に表が増えることはないので ite はそのまま使える
+        v = boost::apply_visitor ([&] (const auto & p) {
+          return (* this) (environ_t {} , p);
+        } , e);
+        ite -> second.value = v;
+        ite -> second.known = true;
+        return true;
+      }
+
+      // 葉とラムダは eval と同じ
+      template <typename T>
+      auto operator () (const environ_t & env , const ref <T> & p) const -> value_t {
+        return pro::eval (env , p);
+      }
+
+      auto operator () (const environ_t & env , const ref <apply_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <letrec_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <if_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <match_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <prim_t> & p) const -> value_t {
+        auto a = (* this) (env , p -> lhs);
+        auto r = compute (p -> op , a , (* this) (env , p -> rhs));
+        if (! r) {
+          throw std::runtime_error {message (r.error)};
+        }
+        return std::move (r.value);
+      }
+
+      auto operator () (const environ_t & env , const ref <tuple_t> & p) const -> value_t {
+        std::vector <value_t> xs;
+        xs.reserve (p -> elements.size ());
+        for (auto && e : p -> elements) {
+          xs.push_back ((* this) (env , e));
+        }
+        return make_vector (std::move (xs));
+      }
+    };
+  }
+
+  // eval と同じ値 (失敗なら同じ例外) になる. 同じ memo を使い回せば, 前の評価で覚えた値も使う
+  inline auto memo_eval (memo_t & memo , const environ_t & env , const expression & e) -> value_t {
+    memo.prepare (e);
+    return detail::memo_f {memo} (env , e);
+  }
+}
+
+#endif // PRO_HASHCONS_HPP
@@ -0,0 +1,434 @@
+#ifndef PRO_IMAGE_HPP
+#define PRO_IMAGE_HPP
+#include <utility>
+#include <array>
+#include <algorithm>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include "pro.hpp"
+#include "pro-vm.hpp"
+#include "pro-mmap.hpp"
+
+// コンパイルした vm::code_t をそのまま実行できるバイナリの像にする.
+// 像はヘッダと 8 バイト境界に揃えた配列の並びで, 配列の場所は像の先頭からのオフセットで書くので, どこに写しても使える.
+// 読み込みはヘッダと添字の範囲を 1 度確かめるだけで, ノードを作り直したりポインタを書き換えたりはしない.
+// 命令などの構造体はメモリ上の形のまま書くので, 同じバイト順と構造体の配置の処理系でしか読めない (ヘッダで確かめる).
+// 添字が配列や関数の中に収まることは確かめるが, スタックの使い方までは確かめないので, 自分で書いた像だけを読むこと.
+namespace pro { namespace vm {
+  namespace image_format {
+    constexpr char magic [8] = {'p' , 'r' , 'o' , '-' , 'v' , 'm' , '\0' , '\0'};
+    // 2 でタプルの命令を, 3 で check_function を足した. 1 と 2 の像もそのまま読める
+    // (ただし関数でないものを適用したときは, 引数を評価してから call で失敗する)
+    constexpr std::uint32_t version = 3;
+    constexpr std::uint32_t oldest_version = 1;
+    constexpr std::uint32_t byte_order = 0x01020304;
+
+    // その命令を含んでよい最初の版
+    inline auto first_version (opcode op) -> std::uint32_t {
+      switch (op) {
+        case opcode::make_tuple:
+        case opcode::match_tuple:
+        case opcode::load_element:
+          return 2;
+        case opcode::check_function:
+          return 3;
+        default:
+          return 1;
+      }
+    }
+
+    // 配列の場所. offset は像の先頭から, count は要素の数
+    struct section_t {
+      std::uint64_t offset;
+      std::uint64_t count;
+    };
+
+    enum section : std::size_t {
+      code ,
+      functions ,
+      captures ,
+      names ,
+      chars ,
+      tables ,
+      dense ,
+      sparse ,
+      section_count ,
+    };
+
+    // names の要素. chars の中の範囲
+    struct name_t {
+      std::uint64_t begin;
+      std::uint64_t size;
+    };
+
+    // tables の要素. dense と sparse の中の範囲を持つ case_table_t
+    struct table_t {
+      std::int64_t base;
+      std::uint32_t dense_begin;
+      std::uint32_t dense_size;
+      std::uint32_t sparse_begin;
+      std::uint32_t sparse_size;
+      std::uint32_t on_void;
+      std::uint32_t on_other;
+    };
+
+    using sparse_t = std::pair <std::int64_t , std::uint32_t>;
+
+    struct header_t {
+      char magic [8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      // 書いた処理系での sizeof (instruction) , sizeof (function_t) , sizeof (capture_t) , sizeof (sparse_t)
+      std::uint32_t layout [4];
+      std::uint64_t size;
+      section_t sections [section_count];
+    };
+
+    inline auto layout () {
+      return std::array <std::uint32_t , 4> {{sizeof (instruction) , sizeof (function_t) , sizeof (capture_t) , sizeof (sparse_t)}};
+    }
+  }
+
+  // code を像にする. 構造体の詰め物は 0 で埋めるので, 同じ code からは同じバイト列になる
+  inline auto serialize (const code_t & code) -> std::string {
+    namespace f = image_format;
+    f::header_t h;
+    std::memset (& h , 0 , sizeof h);
+    std::memcpy (h.magic , f::magic , sizeof h.magic);
+    h.version = f::version;
+    h.byte_order = f::byte_order;
+    auto layout = f::layout ();
+    std::copy (layout.begin () , layout.end () , h.layout);
+
+    std::uint64_t chars = 0;
+    std::uint64_t dense = 0;
+    std::uint64_t sparse = 0;
+    for (auto && n : code.names) {
+      chars += n.size ();
+    }
+    for (auto && t : code.tables) {
+      dense += t.dense.size ();
+      sparse += t.sparse.size ();
+    }
+    std::uint64_t counts [f::section_count] = {
+      code.code.size () , code.functions.size () , code.captures.size () , code.names.size () ,
+      chars , code.tables.size () , dense , sparse ,
+    };
+    std::size_t sizes [f::section_count] = {
+      sizeof (instruction) , sizeof (function_t) , sizeof (capture_t) , sizeof (f::name_t) ,
+      1 , sizeof (f::table_t) , sizeof (std::uint32_t) , sizeof (f::sparse_t) ,
+    };
+    std::uint64_t at = sizeof h;
+    for (std::size_t i = 0; i < f::section_count; ++ i) {
+      at = (at + 7) / 8 * 8;
+      h.sections [i] = f::section_t {at , counts [i]};
+      at += counts [i] * sizes [i];
+    }
+    h.size = (at + 7) / 8 * 8;
+
+    std::string out (h.size , '\0');
+    auto base = & out [0];
+    std::memcpy (base , & h , sizeof h);
+    // 詰め物を 0 にしたものを写す
+    auto put = [&] (std::size_t section , std::size_t i , const auto & x) {
+      std::memcpy (base + h.sections [section].offset + i * sizeof x , & x , sizeof x);
+    };
+    for (std::size_t i = 0; i < code.code.size (); ++ i) {
+      instruction x;
+      std::memset (& x , 0 , sizeof x);
+      x.op = code.code [i].op;
+      x.a = code.code [i].a;
+      x.b = code.code [i].b;
+      put (f::code , i , x);
+    }
+    for (std::size_t i = 0; i < code.functions.size (); ++ i) {
+      put (f::functions , i , code.functions [i]);
+    }
+    for (std::size_t i = 0; i < code.captures.size (); ++ i) {
+      capture_t x;
+      std::memset (& x , 0 , sizeof x);
+      x.local = code.captures [i].local;
+      x.index = code.captures [i].index;
+      put (f::captures , i , x);
+    }
+    std::uint64_t c = 0;
+    for (std::size_t i = 0; i < code.names.size (); ++ i) {
+      auto & n = code.names [i];
+      put (f::names , i , f::name_t {c , n.size ()});
+      std::memcpy (base + h.sections [f::chars].offset + c , n.data () , n.size ());
+      c += n.size ();
+    }
+    std::uint32_t d = 0;
+    std::uint32_t s = 0;
+    for (std::size_t i = 0; i < code.tables.size (); ++ i) {
+      auto & t = code.tables [i];
+      f::table_t x;
+      std::memset (& x , 0 , sizeof x);
+      x.base = t.base;
+      x.dense_begin = d;
+      x.dense_size = static_cast <std::uint32_t> (t.dense.size ());
+      x.sparse_begin = s;
+      x.sparse_size = static_cast <std::uint32_t> (t.sparse.size ());
+      x.on_void = t.on_void;
+      x.on_other = t.on_other;
+      put (f::tables , i , x);
+      for (auto k : t.dense) {
+        put (f::dense , d ++ , k);
+      }
+      // pair は詰め物ごと写せないので要素ごとに書く (out は 0 で埋めてある)
+      for (auto && e : t.sparse) {
+        auto q = base + h.sections [f::sparse].offset + s ++ * sizeof (f::sparse_t);
+        std::memcpy (q + offsetof (f::sparse_t , first) , & e.first , sizeof e.first);
+        std::memcpy (q + offsetof (f::sparse_t , second) , & e.second , sizeof e.second);
+      }
+    }
+    return out;
+  }
+
+  inline auto save (const code_t & code , const std::string & path) -> void {
+    auto bytes = serialize (code);
+    std::ofstream out {path , std::ios::binary};
+    out.write (bytes.data () , static_cast <std::streamsize> (bytes.size ()));
+    if (! out) {
+      throw std::runtime_error {"cannot write " + path + "."};
+    }
+  }
+
+  // 像の中を直接指す. 像より長生きさせないこと
+  class image_view {
+    const image_format::table_t * table_array;
+    const std::uint32_t * dense_array;
+    const image_format::sparse_t * sparse_array;
+    const image_format::name_t * name_array;
+    const char * char_array;
+
+  public:
+    const instruction * code;
+    const function_t * functions;
+    const capture_t * captures;
+
+    // [p , p + n) を像として読む. p は 8 バイト境界にあること
+    image_view (const void * p , std::size_t n) {
+      namespace f = image_format;
+      auto fail = [] (const char * what) {
+        throw std::runtime_error {std::string {"invalid image: "} + what};
+      };
+      auto base = static_cast <const char *> (p);
+      if (reinterpret_cast <std::uintptr_t> (base) % 8 != 0) {
+        fail ("not aligned.");
+      }
+      if (n < sizeof (f::header_t)) {
+        fail ("too short.");
+      }
+      auto & h = * reinterpret_cast <const f::header_t *> (base);
+      if (std::memcmp (h.magic , f::magic , sizeof h.magic) != 0) {
+        fail ("bad magic.");
+      }
+      if (h.version < f::oldest_version || h.version > f::version) {
+        throw std::runtime_error {"invalid image: unsupported version " + std::to_string (h.version) + "."};
+      }
+      auto layout = f::layout ();
+      if (h.byte_order != f::byte_order || ! std::equal (layout.begin () , layout.end () , h.layout)) {
+        fail ("written by an incompatible build.");
+      }
+      if (h.size > n) {
+        fail ("truncated.");
+      }
+      std::size_t sizes [f::section_count] = {
+        sizeof (instruction) , sizeof (function_t) , sizeof (capture_t) , sizeof (f::name_t) ,
+        1 , sizeof (f::table_t) , sizeof (std::uint32_t) , sizeof (f::sparse_t) ,
+      };
+      for (std::size_t i = 0; i < f::section_count; ++ i) {
+        auto & s = h.sections [i];
+        if (s.offset % 8 != 0 || s.offset < sizeof h || s.offset > h.size || s.count > (h.size - s.offset) / sizes [i]) {
+          fail ("section out of range.");
+        }
+      }
+      auto at = [&] (std::size_t i) {
+        return base + h.sections [i].offset;
+      };
+      code = reinterpret_cast <const instruction *> (at (f::code));
+      functions = reinterpret_cast <const function_t *> (at (f::functions));
+      captures = reinterpret_cast <const capture_t *> (at (f::captures));
+      name_array = reinterpret_cast <const f::name_t *> (at (f::names));
+      char_array = at (f::chars);
+      table_array = reinterpret_cast <const f::table_t *> (at (f::tables));
+      dense_array = reinterpret_cast <const std::uint32_t *> (at (f::dense));
+      sparse_array = reinterpret_cast <const f::sparse_t *> (at (f::sparse));
+
+      // 添字がどれも配列の中を指すこと
+      auto count = [&] (std::size_t i) {
+        return h.sections [i].count;
+      };
+      if (count (f::functions) == 0 || functions [0].capture_count != 0) {
+        fail ("no top-level function.");
+      }
+      for (std::uint64_t i = 0; i < count (f::functions); ++ i) {
+        auto & g = functions [i];
+        if (std::uint64_t {g.capture_begin} + g.capture_count > count (f::captures)) {
+          fail ("captures out of range.");
+        }
+      }
+      for (std::uint64_t i = 0; i < count (f::names); ++ i) {
+        if (name_array [i].begin > count (f::chars) || name_array [i].size > count (f::chars) - name_array [i].begin) {
+          fail ("name out of range.");
+        }
+      }
+      for (std::uint64_t i = 0; i < count (f::tables); ++ i) {
+        auto & t = table_array [i];
+        if (std::uint64_t {t.dense_begin} + t.dense_size > count (f::dense) || std::uint64_t {t.sparse_begin} + t.sparse_size > count (f::sparse)) {
+          fail ("table out of range.");
+        }
+      }
+
+      // compile は関数ごとのコードを切れ目なく並べるので, entry の順に並べるとコード全体を分け合う.
+      // 飛び先もスロットも捕獲も, その関数の中に収まることを確かめる
+      std::vector <std::uint32_t> order (count (f::functions));
+      for (std::uint32_t i = 0; i < order.size (); ++ i) {
+        order [i] = i;
+      }
+      std::sort (order.begin () , order.end () , [&] (auto x , auto y) {
+        return functions [x].entry < functions [y].entry;
+      });
+      for (std::size_t k = 0; k < order.size (); ++ k) {
+        auto & g = functions [order [k]];
+        std::uint64_t begin = g.entry;
+        std::uint64_t end = k + 1 < order.size () ? functions [order [k + 1]].entry : count (f::code);
+        if ((k == 0 && begin != 0) || begin >= end || end > count (f::code)) {
+          fail ("function out of range.");
+        }
+        auto last = code [end - 1].op;
+        if (last != opcode::ret && last != opcode::halt && last != opcode::jump && last != opcode::undefined) {
+          fail ("function does not end.");
+        }
+        auto target = [&] (std::uint64_t pc) {
+          if (pc < begin || pc >= end) {
+            fail ("jump out of range.");
+          }
+        };
+        auto slot = [&] (std::uint64_t i) {
+          if (i >= g.locals) {
+            fail ("local out of range.");
+          }
+        };
+        for (auto i = begin; i < end; ++ i) {
+          auto & x = code [i];
+          if (h.version < f::first_version (x.op)) {
+            fail ("opcode not in this version.");
+          }
+          switch (x.op) {
+            case opcode::make_closure:
+            case opcode::make_rec_closure:
+              if (x.a >= count (f::functions)) {
+                fail ("function out of range.");
+              }
+              for (std::uint32_t c = 0; c < functions [x.a].capture_count; ++ c) {
+                auto & from = captures [functions [x.a].capture_begin + c];
+                if (from.local ? from.index >= g.locals : from.index >= g.capture_count) {
+                  fail ("capture out of range.");
+                }
+              }
+              if (x.op == opcode::make_rec_closure) {
+                slot (static_cast <std::uint64_t> (x.b));
+              }
+              break;
+            case opcode::load_local:
+            case opcode::store_local:
+            case opcode::match_void:
+            case opcode::match_int:
+            case opcode::match_tuple:
+            case opcode::load_element:
+              slot (x.a);
+              break;
+            case opcode::load_captured:
+              if (x.a >= g.capture_count) {
+                fail ("capture out of range.");
+              }
+              break;
+            case opcode::jump:
+            case opcode::jump_if_zero:
+              target (x.a);
+              break;
+            case opcode::dispatch: {
+              if (x.a >= count (f::tables)) {
+                fail ("table out of range.");
+              }
+              slot (static_cast <std::uint64_t> (x.b));
+              auto & t = table_array [x.a];
+              auto check = [&] (std::uint32_t k) {
+                if (k != case_table_t::none) {
+                  target (k);
+                }
+              };
+              check (t.on_void);
+              check (t.on_other);
+              for (std::uint32_t k = 0; k < t.dense_size; ++ k) {
+                check (dense_array [t.dense_begin + k]);
+              }
+              for (std::uint32_t k = 0; k < t.sparse_size; ++ k) {
+                check (sparse_array [t.sparse_begin + k].second);
+              }
+              break;
+            }
+            case opcode::undefined:
+              if (x.a >= count (f::names)) {
+                fail ("name out of range.");
+              }
+              break;
+            case opcode::primitive:
+              if (x.a > static_cast <std::uint32_t> (primitive::update)) {
+                fail ("unknown primitive.");
+              }
+              break;
+            case opcode::push_void:
+            case opcode::push_int:
+            case opcode::call:
+            case opcode::tail_call:
+            case opcode::ret:
+            case opcode::halt:
+            case opcode::make_tuple:
+            case opcode::check_function:
+              break;
+            default:
+              fail ("unknown opcode.");
+          }
+        }
+      }
+    }
+
+    auto select (std::uint32_t table , const value_t & v) const {
+      auto & t = table_array [table];
+      return pro::detail::select_case (t.base , dense_array + t.dense_begin , t.dense_size , sparse_array + t.sparse_begin , t.sparse_size , t.on_void , t.on_other , v);
+    }
+
+    auto name (std::uint32_t i) const {
+      return std::string {char_array + name_array [i].begin , name_array [i].size};
+    }
+  };
+
+  // ファイルを 1 回 mmap して, そのまま image_view として読む
+  class mapped_image {
+    mapped_file file;
+    image_view image;
+
+  public:
+    explicit mapped_image (const std::string & path)
+      : file {path}
+      , image {file.data () , file.size ()} {}
+
+    auto view () const noexcept -> const image_view & {
+      return image;
+    }
+  };
+
+  inline auto run (const image_view & image , const value_t & argument = value_t {}) -> value_t {
+    return detail::execute (image , argument);
+  }
+}}
+
+#endif // PRO_IMAGE_HPP
@@ -0,0 +1,224 @@
+#ifndef PRO_INCREMENTAL_HPP
+#define PRO_INCREMENTAL_HPP
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include "pro.hpp"
+
+// Let を入れ子にした式を束縛ごとに分けて評価し, 束縛した式を差し替えたら, その値に依存するところだけを評価し直す.
+// Let (x0 , e0 , Let (x1 , e1 , ... body)) の e_i は x0 .. x{i-1} だけを, body は全部を見る.
+// 依存は各式の自由変数から求める. 評価し直した値が前と同じなら, その先へは広げない.
+// 値と例外は eval と同じ. ただし失敗した束縛より後でも, それに依存しない束縛は評価する (eval はそこで止まる)
+namespace pro {
+  class incremental_t {
+    static constexpr std::size_t outer = static_cast <std::size_t> (-1);
+
+    enum class status : std::uint8_t {
+      ok ,
+      failed ,
+      // 依存先が失敗していて評価できない. eval ならそこまで来ない
+      blocked ,
+    };
+
+    // 束縛 1 つ. 最後の 1 つは body で, name は使わない
+    struct node_t {
+      symbol name;
+      expression expr;
+      // 自由変数と, それを束縛している束縛の番号. 外の環境から来るなら outer
+      std::vector <std::pair <symbol , std::size_t>> deps;
+      value_t value;
+      std::exception_ptr error;
+      status state;
+      bool dirty;
+    };
+
+    environ_t env;
+    std::vector <node_t> nodes;
+    // 名前ごとの, それを束縛している束縛の番号 (昇順). 束縛の名前は変わらない
+    std::unordered_map <std::uint32_t , std::vector <std::size_t>> binders;
+    // 各束縛の値を使っている束縛の番号
+    std::vector <std::vector <std::size_t>> users;
+    std::priority_queue <std::size_t , std::vector <std::size_t> , std::greater <std::size_t>> queue;
+    std::size_t evaluated;
+
+    static auto same (const node_t & n , status s , const value_t & v) {
+      if (n.state != s) {
+        return false;
+      }
+      if (n.value.is_int () && v.is_int ()) {
+        return n.value.as_int () == v.as_int ();
+      }
+      return identical (n.value , v);
+    }
+
+    auto mark (std::size_t i) -> void {
+      if (! nodes [i].dirty) {
+        nodes [i].dirty = true;
+        queue.push (i);
+      }
+    }
+
+    // 束縛 i の式の自由変数を, i より前で最後にその名前を束縛したものに結ぶ
+    auto connect (std::size_t i) -> void {
+      auto & n = nodes [i];
+      for (auto && d : n.deps) {
+        if (d.second != outer) {
+          auto & u = users [d.second];
+          u.erase (std::find (u.begin () , u.end () , i));
+        }
+      }
+      n.deps.clear ();
+      std::vector <symbol> fv;
+      detail::analyze (n.expr , fv);
+      std::sort (fv.begin () , fv.end () , detail::symbol_less);
+      fv.erase (std::unique (fv.begin () , fv.end ()) , fv.end ());
+      for (auto x : fv) {
+        auto j = outer;
+        auto b = binders.find (x.id);
+        if (b != binders.end ()) {
+          auto ite = std::lower_bound (b -> second.begin () , b -> second.end () , i);
+          if (ite != b -> second.begin ()) {
+            j = * -- ite;
+          }
+        }
+        n.deps.emplace_back (x , j);
+        if (j != outer) {
+          users [j].push_back (i);
+        }
+      }
+    }
+
+    // 依存先の今の値だけを並べた環境で評価する. 式が見る名前はそれで全部なので eval と同じ値になる
+    auto recompute (std::size_t i) -> void {
+      auto & n = nodes [i];
+      n.dirty = false;
+      ++ evaluated;
+      auto e = env;
+      auto s = status::ok;
+      for (auto && d : n.deps) {
+        if (d.second == outer) {
+          continue;
+        }
+        auto & m = nodes [d.second];
+        if (m.state != status::ok) {
+          s = status::blocked;
+          break;
+        }
+        e = extend (e , d.first , m.value);
+      }
+      value_t v = value_t::undefined ();
+      std::exception_ptr error;
+      if (s == status::ok) {
+        try {
+          v = eval (e , n.expr);
+        }
+        catch (...) {
+          s = status::failed;
+          error = std::current_exception ();
+        }
+      }
+      auto changed = ! same (n , s , v);
+      n.value = std::move (v);
+      n.error = error;
+      n.state = s;
+      if (changed) {
+        for (auto u : users [i]) {
+          mark (u);
+        }
+      }
+    }
+
+  public:
+    // e の外側から Let を剥がして束縛に分ける. 変数以外を束縛する Let からは body に入れる
+    incremental_t (const environ_t & base , const expression & e)
+      : env {base}
+      , nodes {}
+      , binders {}
+      , users {}
+      , queue {}
+      , evaluated {0} {
+      auto p = & e;
+      for (;;) {
+        auto a = boost::get <ref <apply_t>> (p);
+        auto l = a ? boost::get <ref <lambda_t>> (& (* a) -> func) : nullptr;
+        auto x = l ? boost::get <ref <var_t>> (& (* l) -> arg) : nullptr;
+        if (! x) {
+          break;
+        }
+        binders [(* x) -> name.id].push_back (nodes.size ());
+        nodes.push_back (node_t {(* x) -> name , (* a) -> expr , {} , value_t::undefined () , nullptr , status::ok , false});
+        p = & (* l) -> body;
+      }
+      nodes.push_back (node_t {symbol {} , * p , {} , value_t::undefined () , nullptr , status::ok , false});
+      users.resize (nodes.size ());
+      for (std::size_t i = 0; i < nodes.size (); ++ i) {
+        connect (i);
+        mark (i);
+      }
+    }
+
+    // 束縛の数 (body は数えない)
+    auto size () const noexcept {
+      return nodes.size () - 1;
+    }
+
+    auto name (std::size_t i) const {
+      return nodes [i].name;
+    }
+
+    auto binding (std::size_t i) const -> const expression & {
+      return nodes [i].expr;
+    }
+
+    // 束縛 i の式を e に差し替える. 評価は value () まで遅らせる
+    auto rebind (std::size_t i , const expression & e) -> void {
+      if (i >= size ()) {
+        throw std::out_of_range {"incremental_t::rebind"};
+      }
+      nodes [i].expr = e;
+      connect (i);
+      mark (i);
+    }
+
+    // 汚れた束縛を前から順に評価し直して, 式全体の値を返す.
+    // 失敗していれば, eval が最初に出会う失敗 (いちばん前の束縛のもの) を投げ直す
+    auto value () -> value_t {
+      while (! queue.empty ()) {
+        auto i = queue.top ();
+        queue.pop ();
+        if (nodes [i].dirty) {
+          recompute (i);
+        }
+      }
+      for (auto && n : nodes) {
+        if (n.state == status::failed) {
+          std::rethrow_exception (n.error);
+        }
+      }
+      return nodes.back ().value;
+    }
+
+    // 今の束縛から Let の入れ子を組み立て直す
+    auto program () const -> expression {
+      auto e = nodes.back ().expr;
+      for (auto i = size (); i -- > 0;) {
+        e = Let (Var (nodes [i].name) , expression {nodes [i].expr} , std::move (e));
+      }
+      return e;
+    }
+
+    // これまでに評価した束縛の数 (body を含む)
+    auto evaluations () const noexcept {
+      return evaluated;
+    }
+  };
+}
+
+#endif // PRO_INCREMENTAL_HPP
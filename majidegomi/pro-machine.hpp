@@ -0,0 +1,316 @@
+#ifndef PRO_MACHINE_HPP
+#define PRO_MACHINE_HPP
+#include <utility>
+#include <cstddef>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include "pro.hpp"
+
+// 継続を明示的なスタックに積んで評価する. 末尾位置の適用は継続を積まないので,
+// ネイティブスタックは評価の長さに関係なく一定で, 継続スタックもプログラムの入れ子の深さまでしか伸びない.
+namespace pro {
+  // strict は引数を先に評価する (eval と同じ). lazy は変数に束縛される引数をサンクにして, 使われたときに一度だけ評価する.
+  enum class strategy : std::uint8_t {
+    strict ,
+    lazy ,
+  };
+
+  namespace detail {
+    // 関数部分を評価し終わったら引数を評価する.
+    // apply_t は machine が持っているプログラムの木が生かしているので生ポインタで持つ
+    struct arg_k {
+      const apply_t * apply;
+      environ_t env;
+    };
+
+    // 引数を評価し終わったら f に適用する
+    struct call_k {
+      ref <closure_t> f;
+    };
+
+    // サンクの中身を評価し終わったら結果を覚える
+    struct force_k {
+      ref <thunk_t> t;
+    };
+
+    // 左の被演算子を評価し終わったら右を評価する
+    struct rhs_k {
+      const prim_t * prim;
+      environ_t env;
+    };
+
+    // 右の被演算子を評価し終わったら計算する
+    struct compute_k {
+      const prim_t * prim;
+      value_t lhs;
+    };
+
+    // 条件を評価し終わったら枝を選ぶ. 枝は末尾位置なので継続を積まない
+    struct branch_k {
+      const if_t * node;
+      environ_t env;
+    };
+
+    // 照合する値を評価し終わったら節を選ぶ. 節の本体も末尾位置
+    struct select_k {
+      const match_t * node;
+      environ_t env;
+    };
+
+    // タプルの要素を評価し終わったら次の要素へ進む. 全部そろったらベクタにする
+    struct element_k {
+      const tuple_t * node;
+      environ_t env;
+      std::vector <value_t> values;
+    };
+
+    using continuation = boost::variant <arg_k , call_k , force_k , rhs_k , compute_k , branch_k , select_k , element_k>;
+  }
+
+  class machine {
+    // 継続が生ポインタで指すノードを生かしておく
+    expression program;
+    std::vector <detail::continuation> k;
+    environ_t env;
+    expression control;
+    value_t value;
+    bool returning;
+    strategy mode;
+
+    auto produce (value_t v) {
+      value = std::move (v);
+      returning = true;
+    }
+
+    auto next (const expression & e) {
+      auto tmp = e;
+      control = std::move (tmp);
+    }
+
+    // 評価せずに束縛できる形にする. すぐ値になるものはサンクを作らない
+    static auto delay (const expression & e , const environ_t & env) -> value_t {
+      if (auto i = boost::get <ref <int_value_t>> (& e)) {
+        return value_t::integer ((* i) -> data);
+      }
+      if (boost::get <ref <void_value_t>> (& e)) {
+        return value_t {};
+      }
+      if (auto x = boost::get <ref <var_t>> (& e)) {
+        if (auto v = lookup (env , (* x) -> name)) {
+          return * v;
+        }
+      }
+      if (auto l = boost::get <ref <lambda_t>> (& e)) {
+        return close (env , * l);
+      }
+      return make <thunk_t> (e , env);
+    }
+
+    // 束縛されていた値を返す. まだ評価していないサンクなら中身を評価しに行く
+    auto produce_forced (const value_t & v) {
+      if (! v.is (object_kind::thunk)) {
+        produce (v);
+        return;
+      }
+      auto t = v.get <thunk_t> ();
+      if (t -> forced) {
+        produce (t -> value);
+        return;
+      }
+      k.push_back (detail::force_k {ref <thunk_t> {t}});
+      env = t -> env;
+      next (t -> expr);
+    }
+
+  public:
+    machine (const environ_t & initial , const expression & e , strategy s = strategy::strict)
+      : program {e}
+      , k {}
+      , env {initial}
+      , control {e}
+      , value {}
+      , returning {false}
+      , mode {s} {}
+
+    // 1 遷移だけ進める. 評価が終わっていたら false
+    auto step () -> bool {
+      if (! returning) {
+        boost::apply_visitor (* this , control);
+        return true;
+      }
+      if (k.empty ()) {
+        return false;
+      }
+      if (auto a = boost::get <detail::arg_k> (& k.back ())) {
+        if (! value.is (object_kind::closure)) {
+          throw std::runtime_error {message (failure::not_a_function)};
+        }
+        auto c = ref <closure_t> {value.get <closure_t> ()};
+        auto x = boost::get <ref <var_t>> (& c -> lambda -> arg);
+        if (mode == strategy::lazy && x) {
+          env = extend (environ_t {{} , c} , (* x) -> name , delay (a -> apply -> expr , a -> env));
+          next (c -> lambda -> body);
+          k.pop_back ();
+          returning = false;
+          return true;
+        }
+        next (a -> apply -> expr);
+        env = std::move (a -> env);
+        k.back () = detail::call_k {std::move (c)};
+      }
+      else if (auto t = boost::get <detail::force_k> (& k.back ())) {
+        t -> t -> update (value);
+        k.pop_back ();
+        return true;
+      }
+      else if (auto r = boost::get <detail::rhs_k> (& k.back ())) {
+        auto p = r -> prim;
+        env = std::move (r -> env);
+        k.back () = detail::compute_k {p , std::move (value)};
+        next (p -> rhs);
+      }
+      else if (auto c = boost::get <detail::compute_k> (& k.back ())) {
+        auto r = compute (c -> prim -> op , c -> lhs , value);
+        if (! r) {
+          throw std::runtime_error {message (r.error)};
+        }
+        value = std::move (r.value);
+        k.pop_back ();
+        return true;
+      }
+      else if (auto b = boost::get <detail::branch_k> (& k.back ())) {
+        auto e = branch (* b -> node , value);
+        if (! e) {
+          throw std::runtime_error {message (failure::not_an_integer)};
+        }
+        next (* e);
+        env = std::move (b -> env);
+        k.pop_back ();
+      }
+      else if (auto m = boost::get <detail::select_k> (& k.back ())) {
+        auto p = m -> node;
+        auto i = p -> table.select (value);
+        if (i == case_table_t::none) {
+          throw std::runtime_error {message (failure::match_failure)};
+        }
+        env = std::move (m -> env);
+        if (auto x = p -> binder (i)) {
+          env = extend (env , x -> name , value);
+        }
+        next (p -> clauses [i].body);
+        k.pop_back ();
+      }
+      else if (auto t = boost::get <detail::element_k> (& k.back ())) {
+        t -> values.push_back (std::move (value));
+        if (t -> values.size () == t -> node -> elements.size ()) {
+          value = make_vector (std::move (t -> values));
+          k.pop_back ();
+          return true;
+        }
+        env = t -> env;
+        next (t -> node -> elements [t -> values.size ()]);
+      }
+      else {
+        auto f = std::move (boost::get <detail::call_k> (k.back ()).f);
+        k.pop_back ();
+        env = environ_t {{} , std::move (f)};
+        auto & l = env.closure -> lambda;
+        if (! pattern_match (l -> arg , value , env)) {
+          throw std::runtime_error {message (failure::match_failure)};
+        }
+        // 末尾呼び出し: 継続を積まずに本体へ進む
+        next (l -> body);
+      }
+      returning = false;
+      return true;
+    }
+
+    // 高々 fuel 回だけ遷移を進めて, 進めた回数を返す. 止めたところから何度でも続けられる
+    auto advance (std::size_t fuel) -> std::size_t {
+      std::size_t used = 0;
+      while (used < fuel && step ()) {
+        ++ used;
+      }
+      return used;
+    }
+
+    auto done () const noexcept {
+      return returning && k.empty ();
+    }
+
+    auto result () const -> const value_t & {
+      return value;
+    }
+
+    auto depth () const noexcept {
+      return k.size ();
+    }
+
+    auto operator () (const ref <void_value_t> &) -> void {
+      produce (value_t {});
+    }
+
+    auto operator () (const ref <int_value_t> & p) -> void {
+      produce (value_t::integer (p -> data));
+    }
+
+    auto operator () (const ref <var_t> & p) -> void {
+      auto v = lookup (env , p -> name);
+      if (! v) {
+        std::stringstream ss;
+        ss << name_of (p -> name) << " is undefined.";
+        throw std::runtime_error {ss.str ()};
+      }
+      produce_forced (* v);
+    }
+
+    auto operator () (const ref <lambda_t> & p) -> void {
+      produce (close (env , p));
+    }
+
+    auto operator () (const ref <apply_t> & p) -> void {
+      k.push_back (detail::arg_k {p.get () , env});
+      next (p -> func);
+    }
+
+    auto operator () (const ref <letrec_t> & p) -> void {
+      env = extend (env , p -> name , close (env , p));
+      next (p -> body);
+    }
+
+    auto operator () (const ref <prim_t> & p) -> void {
+      k.push_back (detail::rhs_k {p.get () , env});
+      next (p -> lhs);
+    }
+
+    auto operator () (const ref <if_t> & p) -> void {
+      k.push_back (detail::branch_k {p.get () , env});
+      next (p -> test);
+    }
+
+    auto operator () (const ref <match_t> & p) -> void {
+      k.push_back (detail::select_k {p.get () , env});
+      next (p -> scrutinee);
+    }
+
+    auto operator () (const ref <tuple_t> & p) -> void {
+      if (p -> elements.empty ()) {
+        produce (make_vector ({}));
+        return;
+      }
+      std::vector <value_t> values;
+      values.reserve (p -> elements.size ());
+      k.push_back (detail::element_k {p.get () , env , std::move (values)});
+      next (p -> elements.front ());
+    }
+  };
+
+  inline auto run (const environ_t & env , const expression & e , strategy s = strategy::strict) -> value_t {
+    machine m {env , e , s};
+    while (m.step ()) {}
+    return m.result ();
+  }
+}
+
+#endif // PRO_MACHINE_HPP
@@ -0,0 +1,63 @@
+#ifndef PRO_MMAP_HPP
+#define PRO_MMAP_HPP
+#include <string>
+#include <cstddef>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace pro {
+  // 読み取り専用でファイルを丸ごとメモリに写す
+  class mapped_file {
+    const char * bytes;
+    std::size_t length;
+
+  public:
+    explicit mapped_file (const std::string & path)
+      : bytes {nullptr}
+      , length {0} {
+      auto fd = ::open (path.c_str () , O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error {"cannot open " + path + "."};
+      }
+      struct stat st;
+      if (::fstat (fd , & st) != 0) {
+        ::close (fd);
+        throw std::runtime_error {"cannot stat " + path + "."};
+      }
+      length = static_cast <std::size_t> (st.st_size);
+      if (length != 0) {
+        auto p = ::mmap (nullptr , length , PROT_READ , MAP_PRIVATE , fd , 0);
+        if (p == MAP_FAILED) {
+          ::close (fd);
+          throw std::runtime_error {"cannot map " + path + "."};
+        }
+        // 前から 1 回読むだけ
+        ::madvise (p , length , MADV_SEQUENTIAL);
+        bytes = static_cast <const char *> (p);
+      }
+      ::close (fd);
+    }
+
+    mapped_file (const mapped_file &) = delete;
+    auto operator = (const mapped_file &) -> mapped_file & = delete;
+
+    ~ mapped_file () {
+      if (bytes) {
+        ::munmap (const_cast <char *> (bytes) , length);
+      }
+    }
+
+    auto data () const noexcept {
+      return bytes;
+    }
+
+    auto size () const noexcept {
+      return length;
+    }
+  };
+}
+
+#endif // PRO_MMAP_HPP
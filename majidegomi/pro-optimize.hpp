@@ -0,0 +1,476 @@
+#ifndef PRO_OPTIMIZE_HPP
+#define PRO_OPTIMIZE_HPP
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "pro.hpp"
+
+// 評価の前に木を書き換える.
+//   - Let で束縛したリテラルと変数は使うところへ埋め込む (定数伝播, 変数のコピー伝播)
+//   - 使われない束縛は, 束縛する式に副作用 (失敗) がなければ消す
+//   - 一度しか使われないラムダは, 使うところがラムダの内側でなければ埋め込む
+//   - Lambda (Int (n) , b) を Int (n) に適用しているところは b にする
+//   - 整数リテラル同士の演算は畳み込み, 条件がリテラルの If と照合する値がリテラルの Case は選ばれる枝だけにする
+// 変わらなかった部分木は元のノードをそのまま使う.
+namespace pro {
+  namespace detail {
+    inline auto same_node (const expression & a , const expression & b) {
+      return a.which () == b.which () && boost::apply_visitor ([&] (const auto & p) {
+        using node = std::decay_t <decltype (p)>;
+        return static_cast <const object_t *> (p.get ()) == static_cast <const object_t *> (boost::get <node> (b).get ());
+      } , a);
+    }
+
+    inline auto is_literal (const expression & e) {
+      return boost::get <ref <int_value_t>> (& e) || boost::get <ref <void_value_t>> (& e);
+    }
+
+    // 一度しか使われない x に v を埋め込む. v の自由変数を束縛し直すところの下に x があったら諦めて false
+    struct substitute_f {
+      symbol x;
+      const expression & v;
+      const std::vector <symbol> & fv;
+      bool ok;
+
+      auto captures (symbol z) const {
+        return std::find (fv.begin () , fv.end () , z) != fv.end ();
+      }
+
+      auto rebuilt (const expression & e) -> expression {
+        return boost::apply_visitor (* this , e);
+      }
+
+      auto operator () (const ref <void_value_t> & p) -> expression {
+        return p;
+      }
+
+      auto operator () (const ref <int_value_t> & p) -> expression {
+        return p;
+      }
+
+      auto operator () (const ref <var_t> & p) -> expression {
+        if (p -> name == x) {
+          return v;
+        }
+        return p;
+      }
+
+      // 束縛する名前 zs の下を置き換える
+      auto under (const std::vector <symbol> & zs , const expression & e) -> expression {
+        if (std::find (zs.begin () , zs.end () , x) != zs.end ()) {
+          return e;
+        }
+        if (std::none_of (zs.begin () , zs.end () , [&] (symbol z) { return captures (z); })) {
+          return rebuilt (e);
+        }
+        // zs の下に x があったら捕獲されてしまう
+        std::vector <symbol> top;
+        analyze (e , top);
+        if (std::find (top.begin () , top.end () , x) != top.end ()) {
+          ok = false;
+        }
+        return e;
+      }
+
+      auto under (symbol z , const expression & e) -> expression {
+        return under (std::vector <symbol> {z} , e);
+      }
+
+      auto operator () (const ref <lambda_t> & p) -> expression {
+        std::vector <symbol> bound;
+        bound_names (p -> arg , bound);
+        auto body = under (bound , p -> body);
+        if (same_node (body , p -> body)) {
+          return p;
+        }
+        return Lambda (expression {p -> arg} , std::move (body));
+      }
+
+      auto operator () (const ref <apply_t> & p) -> expression {
+        auto f = rebuilt (p -> func);
+        auto e = rebuilt (p -> expr);
+        if (same_node (f , p -> func) && same_node (e , p -> expr)) {
+          return p;
+        }
+        return Apply (std::move (f) , std::move (e));
+      }
+
+      auto operator () (const ref <letrec_t> & p) -> expression {
+        auto f = under (p -> name , p -> func);
+        auto b = under (p -> name , p -> body);
+        if (same_node (f , p -> func) && same_node (b , p -> body)) {
+          return p;
+        }
+        return LetRec (Var (p -> name) , std::move (f) , std::move (b));
+      }
+
+      auto operator () (const ref <prim_t> & p) -> expression {
+        auto l = rebuilt (p -> lhs);
+        auto r = rebuilt (p -> rhs);
+        if (same_node (l , p -> lhs) && same_node (r , p -> rhs)) {
+          return p;
+        }
+        return Prim (p -> op , std::move (l) , std::move (r));
+      }
+
+      auto operator () (const ref <if_t> & p) -> expression {
+        auto t = rebuilt (p -> test);
+        auto c = rebuilt (p -> consequent);
+        auto a = rebuilt (p -> alternative);
+        if (same_node (t , p -> test) && same_node (c , p -> consequent) && same_node (a , p -> alternative)) {
+          return p;
+        }
+        return If (std::move (t) , std::move (c) , std::move (a));
+      }
+
+      auto operator () (const ref <match_t> & p) -> expression {
+        auto e = rebuilt (p -> scrutinee);
+        auto changed = ! same_node (e , p -> scrutinee);
+        std::vector <clause_t> cs;
+        for (std::uint32_t i = 0; i < p -> clauses.size (); ++ i) {
+          auto & c = p -> clauses [i];
+          auto x = p -> binder (i);
+          auto b = x ? under (x -> name , c.body) : rebuilt (c.body);
+          changed = changed || ! same_node (b , c.body);
+          cs.push_back (clause_t {c.pattern , std::move (b)});
+        }
+        if (! changed) {
+          return p;
+        }
+        return Case (std::move (e) , std::move (cs));
+      }
+
+      auto operator () (const ref <tuple_t> & p) -> expression {
+        std::vector <expression> es;
+        auto changed = false;
+        for (auto && e : p -> elements) {
+          es.push_back (rebuilt (e));
+          changed = changed || ! same_node (es.back () , e);
+        }
+        if (! changed) {
+          return p;
+        }
+        return Tuple (std::move (es));
+      }
+    };
+
+    struct optimizer {
+      static constexpr std::size_t free = static_cast <std::size_t> (-1);
+
+      // 今見ている位置で見える束縛. 後ろほど内側
+      struct binding {
+        symbol name;
+        // 使うところへ埋め込むリテラルか変数. 無ければ埋め込まない
+        expression value;
+        bool inline_value;
+        // value が変数なら, Let の位置でその変数が指していた束縛 (無ければ free)
+        std::size_t target;
+        std::size_t uses;
+        // 束縛したときのラムダの深さ. これより深いところで使われたら under_lambda
+        std::size_t depth;
+        bool under_lambda;
+      };
+
+      std::vector <binding> scope;
+      std::size_t depth = 0;
+
+      auto find (symbol x) const {
+        for (auto i = scope.size (); i > 0; -- i) {
+          if (scope [i - 1].name == x) {
+            return i - 1;
+          }
+        }
+        return free;
+      }
+
+      auto bind (symbol x , expression value = {} , bool inline_value = false , std::size_t target = free) {
+        scope.push_back (binding {x , std::move (value) , inline_value , target , 0 , depth , false});
+      }
+
+      auto pure (const expression & e) const {
+        if (is_literal (e) || boost::get <ref <lambda_t>> (& e) || boost::get <ref <letrec_t>> (& e)) {
+          return true;
+        }
+        // 外から来る変数は未定義かもしれない
+        if (auto x = boost::get <ref <var_t>> (& e)) {
+          return find ((* x) -> name) != free;
+        }
+        if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          auto & es = (* t) -> elements;
+          return std::all_of (es.begin () , es.end () , [&] (const expression & x) { return pure (x); });
+        }
+        return false;
+      }
+
+      auto optimize (const expression & e) -> expression {
+        return boost::apply_visitor (* this , e);
+      }
+
+      auto operator () (const ref <void_value_t> & p) -> expression {
+        return p;
+      }
+
+      auto operator () (const ref <int_value_t> & p) -> expression {
+        return p;
+      }
+
+      auto operator () (const ref <var_t> & p) -> expression {
+        auto i = find (p -> name);
+        if (i == free) {
+          return p;
+        }
+        auto & b = scope [i];
+        if (b.inline_value) {
+          auto y = boost::get <ref <var_t>> (& b.value);
+          if (! y) {
+            return b.value;
+          }
+          // y がここで別の束縛に隠されていなければ埋め込める
+          auto j = find ((* y) -> name);
+          if (j == b.target) {
+            if (j != free) {
+              ++ scope [j].uses;
+              scope [j].under_lambda = scope [j].under_lambda || depth > scope [j].depth;
+            }
+            return b.value;
+          }
+        }
+        ++ b.uses;
+        b.under_lambda = b.under_lambda || depth > b.depth;
+        return p;
+      }
+
+      auto operator () (const ref <lambda_t> & p) -> expression {
+        std::vector <symbol> bound;
+        bound_names (p -> arg , bound);
+        for (auto x : bound) {
+          bind (x);
+        }
+        ++ depth;
+        auto body = optimize (p -> body);
+        -- depth;
+        scope.resize (scope.size () - bound.size ());
+        if (same_node (body , p -> body)) {
+          return p;
+        }
+        return Lambda (expression {p -> arg} , std::move (body));
+      }
+
+      auto operator () (const ref <apply_t> & p) -> expression {
+        if (auto l = boost::get <ref <lambda_t>> (& p -> func)) {
+          return let (p , * l);
+        }
+        auto f = optimize (p -> func);
+        auto e = optimize (p -> expr);
+        // 関数の位置にラムダが埋め込まれたら Let になったので, もう一度見る
+        if (boost::get <ref <lambda_t>> (& f)) {
+          return optimize (Apply (std::move (f) , std::move (e)));
+        }
+        if (same_node (f , p -> func) && same_node (e , p -> expr)) {
+          return p;
+        }
+        return Apply (std::move (f) , std::move (e));
+      }
+
+      auto operator () (const ref <letrec_t> & p) -> expression {
+        bind (p -> name);
+        auto f = optimize (p -> func);
+        auto self = scope.back ().uses;
+        auto b = optimize (p -> body);
+        auto used = scope.back ().uses > self;
+        scope.pop_back ();
+        if (! used) {
+          return b;
+        }
+        if (same_node (f , p -> func) && same_node (b , p -> body)) {
+          return p;
+        }
+        return LetRec (Var (p -> name) , std::move (f) , std::move (b));
+      }
+
+      // 失敗する演算 (0 での割り算) は畳み込まずに実行時まで残す
+      auto operator () (const ref <prim_t> & p) -> expression {
+        auto l = optimize (p -> lhs);
+        auto r = optimize (p -> rhs);
+        auto li = boost::get <ref <int_value_t>> (& l);
+        auto ri = boost::get <ref <int_value_t>> (& r);
+        if (li && ri) {
+          auto v = compute (p -> op , (* li) -> data , (* ri) -> data);
+          if (v) {
+            return Int (v.value.as_int ());
+          }
+        }
+        if (same_node (l , p -> lhs) && same_node (r , p -> rhs)) {
+          return p;
+        }
+        return Prim (p -> op , std::move (l) , std::move (r));
+      }
+
+      // 選ばれない枝は捨てるので, その中の使用は数えない
+      auto operator () (const ref <if_t> & p) -> expression {
+        auto t = optimize (p -> test);
+        if (auto i = boost::get <ref <int_value_t>> (& t)) {
+          return optimize ((* i) -> data != 0 ? p -> consequent : p -> alternative);
+        }
+        auto c = optimize (p -> consequent);
+        auto a = optimize (p -> alternative);
+        if (same_node (t , p -> test) && same_node (c , p -> consequent) && same_node (a , p -> alternative)) {
+          return p;
+        }
+        return If (std::move (t) , std::move (c) , std::move (a));
+      }
+
+      auto operator () (const ref <match_t> & p) -> expression {
+        auto e = optimize (p -> scrutinee);
+        if (is_literal (e)) {
+          auto i = boost::get <ref <int_value_t>> (& e);
+          auto selected = p -> table.select (i ? value_t::integer ((* i) -> data) : value_t {});
+          // 合う節が無ければ実行時に失敗させる
+          if (selected != case_table_t::none) {
+            if (auto x = p -> binder (selected)) {
+              return optimize (Let (Var (x -> name) , std::move (e) , expression {p -> clauses [selected].body}));
+            }
+            return optimize (p -> clauses [selected].body);
+          }
+        }
+        auto changed = ! same_node (e , p -> scrutinee);
+        std::vector <clause_t> cs;
+        for (std::uint32_t i = 0; i < p -> clauses.size (); ++ i) {
+          auto & c = p -> clauses [i];
+          auto x = p -> binder (i);
+          if (x) {
+            bind (x -> name);
+          }
+          auto b = optimize (c.body);
+          if (x) {
+            scope.pop_back ();
+          }
+          changed = changed || ! same_node (b , c.body);
+          cs.push_back (clause_t {c.pattern , std::move (b)});
+        }
+        if (! changed) {
+          return p;
+        }
+        return Case (std::move (e) , std::move (cs));
+      }
+
+      auto operator () (const ref <tuple_t> & p) -> expression {
+        std::vector <expression> es;
+        auto changed = false;
+        for (auto && e : p -> elements) {
+          es.push_back (optimize (e));
+          changed = changed || ! same_node (es.back () , e);
+        }
+        if (! changed) {
+          return p;
+        }
+        return Tuple (std::move (es));
+      }
+
+      // Apply (Lambda (a , b) , e) つまり Let (a , e , b)
+      auto let (const ref <apply_t> & p , const ref <lambda_t> & l) -> expression {
+        auto e = optimize (p -> expr);
+        auto x = boost::get <ref <var_t>> (& l -> arg);
+        if (! x) {
+          // リテラルのパターンにリテラルを当てているなら照合は済んでいる
+          auto pi = boost::get <ref <int_value_t>> (& l -> arg);
+          auto ei = boost::get <ref <int_value_t>> (& e);
+          if ((pi && ei && (* pi) -> data == (* ei) -> data) || (boost::get <ref <void_value_t>> (& l -> arg) && boost::get <ref <void_value_t>> (& e))) {
+            return optimize (l -> body);
+          }
+          auto f = optimize (p -> func);
+          if (same_node (f , p -> func) && same_node (e , p -> expr)) {
+            return p;
+          }
+          return Apply (std::move (f) , std::move (e));
+        }
+        auto name = (* x) -> name;
+        if (is_literal (e)) {
+          bind (name , e , true);
+        }
+        else if (auto y = boost::get <ref <var_t>> (& e)) {
+          bind (name , e , true , find ((* y) -> name));
+        }
+        else {
+          bind (name);
+        }
+        auto b = optimize (l -> body);
+        auto info = scope.back ();
+        scope.pop_back ();
+        if (info.uses == 0 && pure (e)) {
+          return b;
+        }
+        if (info.uses == 1 && ! info.under_lambda) {
+          if (auto f = boost::get <ref <lambda_t>> (& e)) {
+            substitute_f s {name , e , free_variables (* f) , true};
+            auto r = s.rebuilt (b);
+            if (s.ok) {
+              return optimize (r);
+            }
+          }
+        }
+        if (same_node (b , l -> body) && same_node (e , p -> expr)) {
+          return p;
+        }
+        return Let (Var (name) , std::move (e) , std::move (b));
+      }
+    };
+  }
+
+  inline auto optimize (const expression & e) -> expression {
+    detail::optimizer o;
+    return o.optimize (e);
+  }
+
+  // 木のノードの数. 共有された部分木は出てくるたびに数える
+  inline auto node_count (const expression & e) -> std::size_t {
+    std::size_t n = 0;
+    std::vector <const expression *> work {& e};
+    while (! work.empty ()) {
+      auto p = work.back ();
+      work.pop_back ();
+      ++ n;
+      if (auto l = boost::get <ref <lambda_t>> (p)) {
+        work.push_back (& (* l) -> arg);
+        work.push_back (& (* l) -> body);
+      }
+      else if (auto a = boost::get <ref <apply_t>> (p)) {
+        work.push_back (& (* a) -> func);
+        work.push_back (& (* a) -> expr);
+      }
+      else if (auto r = boost::get <ref <letrec_t>> (p)) {
+        // 束縛する変数とラムダも 1 つずつ数える
+        n += 2;
+        work.push_back (& (* r) -> func -> arg);
+        work.push_back (& (* r) -> func -> body);
+        work.push_back (& (* r) -> body);
+      }
+      else if (auto o = boost::get <ref <prim_t>> (p)) {
+        work.push_back (& (* o) -> lhs);
+        work.push_back (& (* o) -> rhs);
+      }
+      else if (auto i = boost::get <ref <if_t>> (p)) {
+        work.push_back (& (* i) -> test);
+        work.push_back (& (* i) -> consequent);
+        work.push_back (& (* i) -> alternative);
+      }
+      else if (auto m = boost::get <ref <match_t>> (p)) {
+        work.push_back (& (* m) -> scrutinee);
+        for (auto && c : (* m) -> clauses) {
+          work.push_back (& c.pattern);
+          work.push_back (& c.body);
+        }
+      }
+      else if (auto t = boost::get <ref <tuple_t>> (p)) {
+        for (auto && x : (* t) -> elements) {
+          work.push_back (& x);
+        }
+      }
+    }
+    return n;
+  }
+}
+
+#endif // PRO_OPTIMIZE_HPP
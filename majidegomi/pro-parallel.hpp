@@ -0,0 +1,444 @@
+#ifndef PRO_PARALLEL_HPP
+#define PRO_PARALLEL_HPP
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <unordered_map>
+#include <stdexcept>
+#include "pro.hpp"
+
+// 互いに依存しない部分式 (演算の左右, タプルの要素) を work-stealing のスレッドプールで同時に評価する.
+// 部分式どうしは環境とクロージャを共有するので, 参照カウントが atomic でないと使えない.
+// まだ試験的なもの: 複数コアで速くなるかは測っていない (1 コアの機械では逐次の eval より遅い).
+// 速さのために使うのは, pro-bench の parallel で速くなることを確かめてから
+#ifndef PRO_ATOMIC_REFCOUNT
+#error "pro-parallel.hpp needs PRO_ATOMIC_REFCOUNT."
+#endif
+
+namespace pro {
+  class fork_join_pool;
+
+  namespace detail {
+    struct parallel_f;
+
+    // 別のスレッドに盗まれるかもしれない評価 1 つ. fork した関数のスタックに置き, join するまで生きている
+    struct fork_task_t {
+      const parallel_f * evaluator;
+      const environ_t * env;
+      const expression * e;
+      value_t value;
+      std::exception_ptr error;
+      std::atomic <bool> done;
+
+      fork_task_t (const parallel_f * f , const environ_t * en , const expression * ex)
+        : evaluator {f}
+        , env {en}
+        , e {ex}
+        , value {}
+        , error {}
+        , done {false} {}
+    };
+
+    inline auto run_task (fork_task_t & t) -> void;
+  }
+
+  // スレッドごとに両端キューを持つ. 自分のキューは後ろから積んで後ろから取り, 暇なスレッドは他のキューの前から盗む.
+  // 0 番のキューは外から parallel_eval を呼んだスレッドが使う (同時に呼べるのは 1 スレッドだけ)
+  class fork_join_pool {
+    struct queue_t {
+      std::mutex mutex;
+      std::deque <detail::fork_task_t *> tasks;
+    };
+
+    struct current_t {
+      const fork_join_pool * pool;
+      std::size_t slot;
+    };
+
+    static auto current () -> current_t & {
+      static thread_local current_t c {nullptr , 0};
+      return c;
+    }
+
+    std::vector <std::unique_ptr <queue_t>> queues;
+    std::vector <std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic <std::size_t> queued;
+    bool stopping;
+
+    auto slot () const {
+      auto & c = current ();
+      return c.pool == this ? c.slot : 0;
+    }
+
+    // 自分のキューの後ろ, 無ければ他のキューの前から取る
+    auto take (std::size_t me) -> detail::fork_task_t * {
+      for (std::size_t i = 0; i < queues.size (); ++ i) {
+        auto & q = * queues [(me + i) % queues.size ()];
+        std::lock_guard <std::mutex> lock {q.mutex};
+        if (! q.tasks.empty ()) {
+          auto t = i == 0 ? q.tasks.back () : q.tasks.front ();
+          if (i == 0) {
+            q.tasks.pop_back ();
+          }
+          else {
+            q.tasks.pop_front ();
+          }
+          -- queued;
+          return t;
+        }
+      }
+      return nullptr;
+    }
+
+    auto work (std::size_t me) -> void {
+      current () = current_t {this , me};
+      for (;;) {
+        if (auto t = take (me)) {
+          detail::run_task (* t);
+          continue;
+        }
+        std::unique_lock <std::mutex> lock {mutex};
+        wake.wait (lock , [&] {
+          return stopping || queued > 0;
+        });
+        if (stopping) {
+          return;
+        }
+      }
+    }
+
+  public:
+    // 自分のキューにこれ以上積まれていたら, もう fork しない
+    static constexpr std::size_t slack = 4;
+
+    explicit fork_join_pool (std::size_t threads = std::thread::hardware_concurrency ())
+      : queues {}
+      , workers {}
+      , mutex {}
+      , wake {}
+      , queued {0}
+      , stopping {false} {
+      auto n = threads ? threads : 1;
+      for (std::size_t i = 0; i < n; ++ i) {
+        queues.emplace_back (new queue_t);
+      }
+      // 呼び出したスレッドも働くので, 作るのは 1 本少なく
+      for (std::size_t i = 1; i < n; ++ i) {
+        workers.emplace_back ([this , i] {
+          work (i);
+        });
+      }
+    }
+
+    fork_join_pool (const fork_join_pool &) = delete;
+    auto operator = (const fork_join_pool &) -> fork_join_pool & = delete;
+
+    ~ fork_join_pool () {
+      {
+        std::lock_guard <std::mutex> lock {mutex};
+        stopping = true;
+      }
+      wake.notify_all ();
+      for (auto && t : workers) {
+        t.join ();
+      }
+    }
+
+    auto size () const noexcept {
+      return queues.size ();
+    }
+
+    // 呼び出したスレッドを 0 番として登録する. 戻るときに元に戻す
+    struct entry_t {
+      current_t saved;
+
+      explicit entry_t (const fork_join_pool * p)
+        : saved {current ()} {
+        if (current ().pool != p) {
+          current () = current_t {p , 0};
+        }
+      }
+
+      entry_t (const entry_t &) = delete;
+      auto operator = (const entry_t &) -> entry_t & = delete;
+
+      ~ entry_t () {
+        current () = saved;
+      }
+    };
+
+    auto has_room () const -> bool {
+      if (queues.size () == 1) {
+        return false;
+      }
+      auto & q = * queues [slot ()];
+      std::lock_guard <std::mutex> lock {q.mutex};
+      return q.tasks.size () < slack;
+    }
+
+    auto push (detail::fork_task_t & t) -> void {
+      {
+        auto & q = * queues [slot ()];
+        std::lock_guard <std::mutex> lock {q.mutex};
+        q.tasks.push_back (& t);
+        ++ queued;
+      }
+      // 眠りかけのスレッドが起こし損ねないよう, 一度 mutex を通ってから起こす
+      {
+        std::lock_guard <std::mutex> lock {mutex};
+      }
+      wake.notify_one ();
+    }
+
+    // t が盗まれていなければここで評価する. 盗まれていたら終わるまで他の仕事を手伝う
+    auto join (detail::fork_task_t & t) -> void {
+      auto me = slot ();
+      {
+        auto & q = * queues [me];
+        std::unique_lock <std::mutex> lock {q.mutex};
+        if (! q.tasks.empty () && q.tasks.back () == & t) {
+          q.tasks.pop_back ();
+          -- queued;
+          lock.unlock ();
+          detail::run_task (t);
+          return;
+        }
+      }
+      while (! t.done.load (std::memory_order_acquire)) {
+        if (auto o = take (me)) {
+          detail::run_task (* o);
+        }
+        else {
+          std::this_thread::yield ();
+        }
+      }
+    }
+  };
+
+  namespace detail {
+    // 部分式の重さの見積もり. 適用は中で何をするか分からないので, それだけで既定の grain に届く重さにする.
+    // If と Case は重い方の枝を数える. 再帰で fork が増えすぎないようにするのは fork_join_pool::slack の役目
+    constexpr std::uint32_t call_cost = 64;
+
+    using cost_table = std::unordered_map <const object_t * , std::uint32_t>;
+
+    // 共有された部分木は一度だけ数える. 深い木でも再帰しないよう後行順に明示的なスタックで辿る
+    inline auto estimate (const expression & root) -> cost_table {
+      cost_table cost;
+      auto saturate = [] (std::uint64_t x) {
+        return static_cast <std::uint32_t> (x < 0xffffffffu ? x : 0xffffffffu);
+      };
+      auto of = [&] (const expression & e) -> std::uint64_t {
+        auto ite = cost.find (node_of (e));
+        return ite == cost.end () ? 1 : ite -> second;
+      };
+      std::vector <std::pair <const expression * , bool>> work {{& root , false}};
+      while (! work.empty ()) {
+        auto w = work.back ();
+        work.pop_back ();
+        auto & e = * w.first;
+        if (cost.count (node_of (e))) {
+          continue;
+        }
+        std::vector <const expression *> children;
+        if (auto a = boost::get <ref <apply_t>> (& e)) {
+          children = {& (* a) -> func , & (* a) -> expr};
+        }
+        else if (auto o = boost::get <ref <prim_t>> (& e)) {
+          children = {& (* o) -> lhs , & (* o) -> rhs};
+        }
+        else if (auto i = boost::get <ref <if_t>> (& e)) {
+          children = {& (* i) -> test , & (* i) -> consequent , & (* i) -> alternative};
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (& e)) {
+          children = {& (* r) -> body};
+        }
+        else if (auto m = boost::get <ref <match_t>> (& e)) {
+          children.push_back (& (* m) -> scrutinee);
+          for (auto && c : (* m) -> clauses) {
+            children.push_back (& c.body);
+          }
+        }
+        else if (auto l = boost::get <ref <lambda_t>> (& e)) {
+          // ラムダを作るのは軽い. 本体は呼ばれたところで見積もる
+          children = {& (* l) -> body};
+        }
+        else if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          for (auto && x : (* t) -> elements) {
+            children.push_back (& x);
+          }
+        }
+        if (! w.second && ! children.empty ()) {
+          work.emplace_back (& e , true);
+          for (auto c : children) {
+            work.emplace_back (c , false);
+          }
+          continue;
+        }
+        std::uint64_t c = 1;
+        if (auto a = boost::get <ref <apply_t>> (& e)) {
+          c = of ((* a) -> func) + of ((* a) -> expr) + call_cost;
+        }
+        else if (auto o = boost::get <ref <prim_t>> (& e)) {
+          c = of ((* o) -> lhs) + of ((* o) -> rhs) + 1;
+        }
+        else if (auto i = boost::get <ref <if_t>> (& e)) {
+          c = of ((* i) -> test) + std::max (of ((* i) -> consequent) , of ((* i) -> alternative)) + 1;
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (& e)) {
+          c = of ((* r) -> body) + 1;
+        }
+        else if (auto m = boost::get <ref <match_t>> (& e)) {
+          std::uint64_t heaviest = 0;
+          for (auto && k : (* m) -> clauses) {
+            heaviest = std::max (heaviest , of (k.body));
+          }
+          c = of ((* m) -> scrutinee) + heaviest + 1;
+        }
+        else if (auto t = boost::get <ref <tuple_t>> (& e)) {
+          for (auto && x : (* t) -> elements) {
+            c += of (x);
+          }
+        }
+        cost [node_of (e)] = saturate (c);
+      }
+      return cost;
+    }
+
+    // eval_tail に渡して, 演算の左右とタプルの要素を fork する. 末尾位置は eval と同じループで続けるので, ネイティブスタックは伸びない.
+    // 関数の本体もこれで評価するので, 呼ばれた先でも fork できる.
+    // 適用は関数を評価して関数であることを確かめてから引数を評価する (eval と同じ順). 関数と引数は同時には評価しない
+    struct parallel_f {
+      fork_join_pool & pool;
+      const cost_table & cost;
+      std::uint32_t grain;
+
+      auto weight (const expression & e) const -> std::uint32_t {
+        auto ite = cost.find (node_of (e));
+        return ite == cost.end () ? 1 : ite -> second;
+      }
+
+      auto operator () (const environ_t & env , const expression & e) const -> value_t {
+        return boost::apply_visitor ([&] (const auto & p) {
+          return (* this) (env , p);
+        } , e);
+      }
+
+      constexpr auto known (const expression & , value_t &) const noexcept {
+        return false;
+      }
+
+      // a と b を評価する. 両方が重くて自分のキューに空きがあれば b を fork する.
+      // 失敗は a から先に見るので, 逐次の eval と同じ例外になる
+      auto both (const environ_t & env , const expression & a , const expression & b) const -> std::pair <value_t , value_t> {
+        if (weight (a) < grain || weight (b) < grain || ! pool.has_room ()) {
+          auto x = (* this) (env , a);
+          return {std::move (x) , (* this) (env , b)};
+        }
+        fork_task_t t {this , & env , & b};
+        pool.push (t);
+        value_t x;
+        std::exception_ptr error;
+        try {
+          x = (* this) (env , a);
+        }
+        catch (...) {
+          error = std::current_exception ();
+        }
+        pool.join (t);
+        if (error) {
+          std::rethrow_exception (error);
+        }
+        if (t.error) {
+          std::rethrow_exception (t.error);
+        }
+        return {std::move (x) , std::move (t.value)};
+      }
+
+      // 葉とラムダは eval と同じ
+      template <typename T>
+      auto operator () (const environ_t & env , const ref <T> & p) const -> value_t {
+        return pro::eval (env , p);
+      }
+
+      auto operator () (const environ_t & env , const ref <apply_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <letrec_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <if_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <match_t> & p) const -> value_t {
+        return eval_tail (env , p , * this);
+      }
+
+      auto operator () (const environ_t & env , const ref <prim_t> & p) const -> value_t {
+        auto ab = both (env , p -> lhs , p -> rhs);
+        auto r = compute (p -> op , ab.first , ab.second);
+        if (! r) {
+          throw std::runtime_error {message (r.error)};
+        }
+        return std::move (r.value);
+      }
+
+      // 隣り合う 2 つずつを both で評価する. 失敗は前の要素から見る
+      auto operator () (const environ_t & env , const ref <tuple_t> & p) const -> value_t {
+        auto & es = p -> elements;
+        std::vector <value_t> xs;
+        xs.reserve (es.size ());
+        std::size_t i = 0;
+        for (; i + 1 < es.size (); i += 2) {
+          auto ab = both (env , es [i] , es [i + 1]);
+          xs.push_back (std::move (ab.first));
+          xs.push_back (std::move (ab.second));
+        }
+        if (i < es.size ()) {
+          xs.push_back ((* this) (env , es [i]));
+        }
+        return make_vector (std::move (xs));
+      }
+    };
+
+    inline auto run_task (fork_task_t & t) -> void {
+      try {
+        t.value = (* t.evaluator) (* t.env , * t.e);
+      }
+      catch (...) {
+        t.error = std::current_exception ();
+      }
+      t.done.store (true , std::memory_order_release);
+    }
+  }
+
+  // eval と同じ値 (失敗なら同じ例外) になる. 見積もりが grain 未満の部分式は fork しない.
+  // ただし演算の左右とタプルの要素は, 逐次なら前の失敗で止まるところでも後ろを評価し終えるまで待つので, 後ろが止まらなければ止まらない
+  inline auto parallel_eval (fork_join_pool & pool , const environ_t & env , const expression & e , std::uint32_t grain = 64) -> value_t {
+    // 盗んだ部分式も join するまでに評価し終えるので, 働き手のぶんもこの session_t で足りる
+    session_t session;
+    // 1 本なら fork しても盗む相手がいないので, 見積もりもせずに逐次の eval に任せる
+    if (pool.size () == 1) {
+      return eval (env , e);
+    }
+    auto cost = detail::estimate (e);
+    fork_join_pool::entry_t entry {& pool};
+    detail::parallel_f f {pool , cost , grain};
+    return f (env , e);
+  }
+}
+
+#endif // PRO_PARALLEL_HPP
@@ -0,0 +1,445 @@
+#ifndef PRO_PARSER_HPP
+#define PRO_PARSER_HPP
+#include <utility>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <iterator>
+#include <stdexcept>
+#include "pro.hpp"
+#include "pro-arena.hpp"
+#include "pro-mmap.hpp"
+
+// pro のテキスト表現. S 式で, ビルダーとほぼ 1 対 1 に対応する.
+//   42 , -7                  Int
+//   ()                       Void
+//   x                        Var. 英字か _ で始まり, 英数字, _, ' が続く
+//   (lambda pattern body)    Lambda
+//   (f a b ...)              Apply (Apply (f , a) , b) ...
+//   (let pattern e body)     Let
+//   (letrec f (lambda ...) body)
+//   (if test consequent alternative)
+//   (+ a b) (- a b) (* a b) (/ a b) (% a b) (< a b) (<= a b) (> a b) (>= a b) (== a b) (!= a b)
+//   (case e (pattern body) ...)
+//   (function (pattern body) ...)
+//   (tuple e ...)            Tuple. パターンにも書ける
+//   (index v i) (size v) (push v x) (update v i x)
+//   ; から行末まではコメント
+// キーワードと演算子は先頭にしか書けず, 変数の名前にもならない. Function の引数の名前 (%case) も読めない.
+namespace pro {
+  namespace detail {
+    // 読んだバイト列から symbol を引く表. 同じ名前を何度読んでも intern を呼ぶのは最初の 1 回だけで,
+    // それ以外は入力のバイトを指したまま比べるだけなので, 名前を 1 つずつ std::string に写さない
+    class name_cache {
+      struct entry {
+        const char * name;
+        std::size_t size;
+        symbol value;
+      };
+
+      std::vector <entry> slots;
+      std::size_t used;
+
+      static auto hash (const char * p , std::size_t n) {
+        std::uint64_t h = 0xcbf29ce484222325u;
+        for (std::size_t i = 0; i < n; ++ i) {
+          h = (h ^ static_cast <unsigned char> (p [i])) * 0x100000001b3u;
+        }
+        // 線形探査で下位ビットしか使わないので, よく混ぜる
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdu;
+        h ^= h >> 33;
+        return static_cast <std::size_t> (h);
+      }
+
+      auto grow () -> void {
+        std::vector <entry> old (slots.size () * 2 , entry {nullptr , 0 , symbol {}});
+        old.swap (slots);
+        for (auto && e : old) {
+          if (e.name) {
+            auto i = hash (e.name , e.size) & (slots.size () - 1);
+            while (slots [i].name) {
+              i = (i + 1) & (slots.size () - 1);
+            }
+            slots [i] = e;
+          }
+        }
+      }
+
+    public:
+      name_cache ()
+        : slots (256 , entry {nullptr , 0 , symbol {}})
+        , used {0} {}
+
+      // p は表より長生きすること
+      auto find (const char * p , std::size_t n) -> symbol {
+        auto i = hash (p , n) & (slots.size () - 1);
+        while (slots [i].name) {
+          if (slots [i].size == n && std::memcmp (slots [i].name , p , n) == 0) {
+            return slots [i].value;
+          }
+          i = (i + 1) & (slots.size () - 1);
+        }
+        auto s = intern (std::string {p , n});
+        slots [i] = entry {p , n , s};
+        if (++ used * 2 > slots.size ()) {
+          grow ();
+        }
+        return s;
+      }
+    };
+
+    // 明示的なスタックで読むので, 入れ子が深くてもネイティブスタックは伸びない
+    template <typename Builder>
+    class parser {
+      enum class form : std::uint8_t {
+        root ,
+        // まだ先頭を読んでいない
+        open ,
+        apply ,
+        lambda ,
+        let ,
+        letrec ,
+        if_ ,
+        prim ,
+        case_ ,
+        function ,
+        tuple ,
+        clause ,
+      };
+
+      // 子の式と節は items と clauses に積み, frame はその始まりだけを覚える.
+      // 入れ子が深くても frame ごとに確保しない
+      struct frame {
+        form kind;
+        primitive op;
+        std::size_t line;
+        std::size_t items;
+        std::size_t clauses;
+      };
+
+      Builder & builder;
+      const char * cursor;
+      const char * last;
+      std::size_t line;
+      name_cache names;
+      std::vector <frame> frames;
+      std::vector <expression> items;
+      std::vector <clause_t> clauses;
+
+      [[noreturn]] auto fail (std::size_t at , const std::string & what) const -> void {
+        throw std::runtime_error {"parse error at line " + std::to_string (at) + ": " + what};
+      }
+
+      static auto delimiter (char c) {
+        return c == '(' || c == ')' || c == ';' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+      }
+
+      auto skip () -> void {
+        while (cursor != last) {
+          auto c = * cursor;
+          if (c == '\n') {
+            ++ line;
+          }
+          else if (c == ';') {
+            while (cursor != last && * cursor != '\n') {
+              ++ cursor;
+            }
+            continue;
+          }
+          else if (c != ' ' && c != '\t' && c != '\r') {
+            return;
+          }
+          ++ cursor;
+        }
+      }
+
+      auto push (form k) -> void {
+        frames.push_back (frame {k , primitive::add , line , items.size () , clauses.size ()});
+      }
+
+      // 今の frame の子の式の数
+      auto count () const {
+        return items.size () - frames.back ().items;
+      }
+
+      static auto keyword (const char * p , std::size_t n , form & kind , primitive & op) {
+        struct entry {
+          const char * text;
+          form kind;
+          primitive op;
+        };
+        // 名前はほとんどキーワードでないので, 先頭の文字で先にふるい落とす
+        if (n > 8 || std::strchr ("lcifptsu+-*/%<>=!" , * p) == nullptr) {
+          return false;
+        }
+        static const entry table [] = {
+          {"lambda" , form::lambda , primitive::add} ,
+          {"let" , form::let , primitive::add} ,
+          {"letrec" , form::letrec , primitive::add} ,
+          {"if" , form::if_ , primitive::add} ,
+          {"case" , form::case_ , primitive::add} ,
+          {"function" , form::function , primitive::add} ,
+          {"tuple" , form::tuple , primitive::add} ,
+          {"+" , form::prim , primitive::add} ,
+          {"-" , form::prim , primitive::sub} ,
+          {"*" , form::prim , primitive::mul} ,
+          {"/" , form::prim , primitive::div} ,
+          {"%" , form::prim , primitive::mod} ,
+          {"<" , form::prim , primitive::less} ,
+          {"<=" , form::prim , primitive::less_equal} ,
+          {">" , form::prim , primitive::greater} ,
+          {">=" , form::prim , primitive::greater_equal} ,
+          {"==" , form::prim , primitive::equal} ,
+          {"!=" , form::prim , primitive::not_equal} ,
+          {"index" , form::prim , primitive::index} ,
+          {"size" , form::prim , primitive::size} ,
+          {"push" , form::prim , primitive::push} ,
+          {"update" , form::prim , primitive::update} ,
+        };
+        for (auto && e : table) {
+          if (std::strlen (e.text) == n && std::memcmp (e.text , p , n) == 0) {
+            kind = e.kind;
+            op = e.op;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      auto number (const char * p , std::size_t n) -> expression {
+        auto negative = * p == '-';
+        std::uint64_t limit = negative ? std::uint64_t {1} << 63 : (std::uint64_t {1} << 63) - 1;
+        std::uint64_t d = 0;
+        for (auto i = negative ? 1u : 0u; i < n; ++ i) {
+          if (p [i] < '0' || '9' < p [i]) {
+            fail (line , "invalid integer '" + std::string {p , n} + "'.");
+          }
+          auto k = static_cast <std::uint64_t> (p [i] - '0');
+          if (d > (limit - k) / 10) {
+            fail (line , "integer '" + std::string {p , n} + "' is out of range.");
+          }
+          d = d * 10 + k;
+        }
+        return builder.Int (static_cast <std::int64_t> (negative ? 0 - d : d));
+      }
+
+      auto name (const char * p , std::size_t n) -> expression {
+        auto head = * p;
+        if (! (('a' <= head && head <= 'z') || ('A' <= head && head <= 'Z') || head == '_')) {
+          fail (line , "invalid name '" + std::string {p , n} + "'.");
+        }
+        for (std::size_t i = 1; i < n; ++ i) {
+          auto c = p [i];
+          if (! (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_' || c == '\'')) {
+            fail (line , "invalid name '" + std::string {p , n} + "'.");
+          }
+        }
+        return builder.Var (names.find (p , n));
+      }
+
+      // 読み終えた式を今の frame に足す
+      auto add (expression && e) -> void {
+        auto & f = frames.back ();
+        if (f.kind == form::open) {
+          f.kind = form::apply;
+        }
+        else if (f.kind == form::function || (f.kind == form::case_ && count () != 0)) {
+          fail (line , "a clause must be (pattern body).");
+        }
+        items.push_back (std::move (e));
+      }
+
+      auto atom () -> void {
+        auto p = cursor;
+        while (cursor != last && ! delimiter (* cursor)) {
+          ++ cursor;
+        }
+        auto n = static_cast <std::size_t> (cursor - p);
+        auto & f = frames.back ();
+        form kind;
+        primitive op;
+        if (keyword (p , n , kind , op)) {
+          if (f.kind != form::open) {
+            fail (line , "'" + std::string {p , n} + "' can be used only at the head of a form.");
+          }
+          f.kind = kind;
+          f.op = op;
+          return;
+        }
+        if (('0' <= * p && * p <= '9') || (* p == '-' && n > 1)) {
+          add (number (p , n));
+        }
+        else {
+          add (name (p , n));
+        }
+      }
+
+      auto arity (const frame & f , std::size_t n , const char * what) const -> void {
+        if (count () != n) {
+          fail (f.line , std::string {what} + " takes " + std::to_string (n) + " expressions.");
+        }
+      }
+
+      // 読み終えた frame から式を作る
+      auto reduce (const frame & f) -> expression {
+        auto x = items.begin () + static_cast <std::ptrdiff_t> (f.items);
+        auto n = count ();
+        switch (f.kind) {
+          case form::apply: {
+            if (n < 2) {
+              fail (f.line , "an application needs an argument.");
+            }
+            expression e = std::move (x [0]);
+            for (std::size_t i = 1; i < n; ++ i) {
+              e = builder.Apply (std::move (e) , std::move (x [i]));
+            }
+            return e;
+          }
+          case form::lambda:
+            arity (f , 2 , "lambda");
+            return builder.Lambda (std::move (x [0]) , std::move (x [1]));
+          case form::let:
+            arity (f , 3 , "let");
+            return builder.Let (std::move (x [0]) , std::move (x [1]) , std::move (x [2]));
+          case form::letrec:
+            arity (f , 3 , "letrec");
+            try {
+              return builder.LetRec (std::move (x [0]) , std::move (x [1]) , std::move (x [2]));
+            }
+            catch (std::runtime_error & error) {
+              fail (f.line , error.what ());
+            }
+          case form::if_:
+            arity (f , 3 , "if");
+            return builder.If (std::move (x [0]) , std::move (x [1]) , std::move (x [2]));
+          case form::prim:
+            // size は右を使わず, update は添字と値を 1 つのタプルにして右に置く
+            if (f.op == primitive::size) {
+              arity (f , 1 , "size");
+              return builder.Prim (f.op , std::move (x [0]) , builder.Void ());
+            }
+            if (f.op == primitive::update) {
+              arity (f , 3 , "update");
+              std::vector <expression> pair (std::make_move_iterator (x + 1) , std::make_move_iterator (x + 3));
+              return builder.Prim (f.op , std::move (x [0]) , builder.Tuple (std::move (pair)));
+            }
+            arity (f , 2 , "an operator");
+            return builder.Prim (f.op , std::move (x [0]) , std::move (x [1]));
+          case form::tuple:
+            return builder.Tuple (std::vector <expression> (std::make_move_iterator (x) , std::make_move_iterator (items.end ())));
+          case form::case_:
+          case form::function: {
+            if (f.kind == form::case_) {
+              arity (f , 1 , "case");
+            }
+            if (clauses.size () == f.clauses) {
+              fail (f.line , "case and function need a clause.");
+            }
+            std::vector <clause_t> cs (std::make_move_iterator (clauses.begin () + static_cast <std::ptrdiff_t> (f.clauses)) , std::make_move_iterator (clauses.end ()));
+            clauses.resize (f.clauses);
+            try {
+              if (f.kind == form::case_) {
+                return builder.Case (std::move (x [0]) , std::move (cs));
+              }
+              return builder.Function (std::move (cs));
+            }
+            catch (std::runtime_error & error) {
+              fail (f.line , error.what ());
+            }
+          }
+          default:
+            // () は Void
+            return builder.Void ();
+        }
+      }
+
+      // ) を読んだ. 今の frame を式にして 1 つ外の frame に足す. 節なら外の case に足す
+      auto close () -> void {
+        auto f = frames.back ();
+        if (f.kind == form::root) {
+          fail (line , "unexpected ')'.");
+        }
+        if (f.kind == form::clause) {
+          arity (f , 2 , "a clause");
+          auto x = items.begin () + static_cast <std::ptrdiff_t> (f.items);
+          clauses.push_back (clause_t {std::move (x [0]) , std::move (x [1])});
+          items.resize (f.items);
+          frames.pop_back ();
+          return;
+        }
+        auto e = reduce (f);
+        items.resize (f.items);
+        frames.pop_back ();
+        add (std::move (e));
+      }
+
+    public:
+      parser (Builder & b , const char * first , const char * l)
+        : builder {b}
+        , cursor {first}
+        , last {l}
+        , line {1}
+        , names {}
+        , frames {}
+        , items {}
+        , clauses {} {}
+
+      auto run () -> expression {
+        push (form::root);
+        for (;;) {
+          skip ();
+          if (cursor == last) {
+            break;
+          }
+          if (* cursor == '(') {
+            ++ cursor;
+            auto parent = frames.back ().kind;
+            auto clause = parent == form::function || (parent == form::case_ && count () != 0);
+            skip ();
+            if (clause && cursor != last && * cursor == ')') {
+              fail (line , "a clause must be (pattern body).");
+            }
+            push (clause ? form::clause : form::open);
+          }
+          else if (* cursor == ')') {
+            ++ cursor;
+            close ();
+          }
+          else {
+            atom ();
+          }
+        }
+        if (frames.size () != 1) {
+          fail (frames.back ().line , "missing ')'.");
+        }
+        if (items.size () != 1) {
+          fail (line , items.empty () ? "no expression." : "more than one expression.");
+        }
+        return std::move (items [0]);
+      }
+    };
+  }
+
+  // [first , last) を 1 つの式として読む. ノードは b で作る (program_t なら arena に入る)
+  template <typename Builder>
+  auto parse (Builder & b , const char * first , const char * last) -> expression {
+    return detail::parser <Builder> {b , first , last} .run ();
+  }
+
+  template <typename Builder>
+  auto parse (Builder & b , const std::string & source) -> expression {
+    return parse (b , source.data () , source.data () + source.size ());
+  }
+
+  // 名前は symbol 表に, ノードは b に写すので, 読み終えたらファイルは閉じてよい
+  template <typename Builder>
+  auto parse_file (Builder & b , const std::string & path) -> expression {
+    mapped_file f {path};
+    return parse (b , f.data () , f.data () + f.size ());
+  }
+}
+
+#endif // PRO_PARSER_HPP
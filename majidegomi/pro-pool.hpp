@@ -0,0 +1,158 @@
+#ifndef PRO_POOL_HPP
+#define PRO_POOL_HPP
+#include <utility>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdexcept>
+#include "pro.hpp"
+#include "pro-vm.hpp"
+
+// 凍結したプログラム (vm::compile (e , parameter) の結果) を, 入力を変えながら何本ものスレッドで評価する.
+// vm::code_t はただのデータで参照カウントを持たないので, 共有しても書き込みは起きない.
+// 実行時のオブジェクトは各スレッドが作って各スレッドで消す. スレッドをまたぐのは整数と () だけ.
+// ただし 63 ビットに収まらない整数は boxed_int_t というヒープのオブジェクトで, job_t::input と job_result_t::value としてスレッドをまたぐ.
+// これが安全なのは, 箱が追跡されず (レジストリに載らず, 他のオブジェクトを指さない),
+// ワーカーは入力を読んで自分のスレッドに作り直すだけで, 結果はワーカーが作って mutex の下で呼び出し側に渡し, その後は呼び出し側だけが触るから.
+// (式の木は共有しないこと. 既定の参照カウントは atomic でない)
+namespace pro {
+  struct job_t {
+    const vm::code_t * program;
+    // 整数か (). ワーカーは読むだけ
+    value_t input;
+  };
+
+  // 関数はスレッドの外に持ち出せないので, 結果が関数なら value は undefined
+  struct job_result_t {
+    value_t value;
+    // 失敗したときの理由. 成功したら空
+    std::string error;
+  };
+
+  class pool {
+    std::vector <std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    // 今のバッチ. mutex で守る
+    const std::vector <job_t> * jobs;
+    std::vector <job_result_t> * results;
+    std::size_t generation;
+    std::size_t busy;
+    bool stopping;
+    // 次に取るジョブ
+    std::atomic <std::size_t> next;
+
+    // 作ったスレッドのもの以外のオブジェクトに触らないよう, 入力も結果もこのスレッドで作り直す
+    static auto local (const value_t & v) -> value_t {
+      if (v.is_int ()) {
+        return value_t::integer (v.as_int ());
+      }
+      return v.is_void () ? value_t {} : value_t::undefined ();
+    }
+
+    static auto perform (const job_t & job) -> job_result_t {
+      if (! job.input.is_int () && ! job.input.is_void ()) {
+        return {value_t::undefined () , "only an integer or () can be passed to a job."};
+      }
+      try {
+        return {local (vm::run (* job.program , local (job.input))) , {}};
+      }
+      catch (std::exception & e) {
+        return {value_t::undefined () , e.what ()};
+      }
+    }
+
+    auto work () -> void {
+      std::size_t seen = 0;
+      for (;;) {
+        const std::vector <job_t> * js;
+        std::vector <job_result_t> * rs;
+        {
+          std::unique_lock <std::mutex> lock {mutex};
+          wake.wait (lock , [&] {
+            return stopping || generation != seen;
+          });
+          if (stopping) {
+            return;
+          }
+          seen = generation;
+          js = jobs;
+          rs = results;
+        }
+        {
+          session_t session;
+          for (auto i = next.fetch_add (1); i < js -> size (); i = next.fetch_add (1)) {
+            (* rs) [i] = perform ((* js) [i]);
+          }
+        }
+        std::lock_guard <std::mutex> lock {mutex};
+        if (-- busy == 0) {
+          finished.notify_one ();
+        }
+      }
+    }
+
+  public:
+    explicit pool (std::size_t n = std::thread::hardware_concurrency ())
+      : workers {}
+      , mutex {}
+      , wake {}
+      , finished {}
+      , jobs {nullptr}
+      , results {nullptr}
+      , generation {0}
+      , busy {0}
+      , stopping {false}
+      , next {0} {
+      for (std::size_t i = 0; i < (n ? n : 1); ++ i) {
+        workers.emplace_back ([this] {
+          work ();
+        });
+      }
+    }
+
+    pool (const pool &) = delete;
+    auto operator = (const pool &) -> pool & = delete;
+
+    ~ pool () {
+      {
+        std::lock_guard <std::mutex> lock {mutex};
+        stopping = true;
+      }
+      wake.notify_all ();
+      for (auto && t : workers) {
+        t.join ();
+      }
+    }
+
+    auto size () const noexcept {
+      return workers.size ();
+    }
+
+    // 全部終わるまで待つ. 結果は js と同じ順
+    auto evaluate (const std::vector <job_t> & js) -> std::vector <job_result_t> {
+      std::vector <job_result_t> rs (js.size ());
+      std::unique_lock <std::mutex> lock {mutex};
+      jobs = & js;
+      results = & rs;
+      next = 0;
+      busy = workers.size ();
+      ++ generation;
+      wake.notify_all ();
+      finished.wait (lock , [&] {
+        return busy == 0;
+      });
+      jobs = nullptr;
+      results = nullptr;
+      return rs;
+    }
+  };
+}
+
+#endif // PRO_POOL_HPP
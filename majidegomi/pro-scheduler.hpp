@@ -0,0 +1,103 @@
+#ifndef PRO_SCHEDULER_HPP
+#define PRO_SCHEDULER_HPP
+#include <utility>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+#include "pro.hpp"
+#include "pro-machine.hpp"
+
+// たくさんの式を 1 つのスレッドで少しずつ順番に評価する.
+// 1 回に進めるのは slice 遷移までなので, 止まらない式があっても他の式は待たされ続けない.
+namespace pro {
+  enum class task_state : std::uint8_t {
+    running ,
+    done ,
+    failed ,
+  };
+
+  struct outcome_t {
+    task_state state;
+    value_t value;
+    // failed のときの理由
+    std::string error;
+    std::size_t steps;
+  };
+
+  class scheduler {
+    struct task_t {
+      std::size_t id;
+      machine m;
+      // 使ってよい遷移の数の残り
+      std::size_t fuel;
+    };
+
+    std::deque <task_t> ready;
+    std::vector <outcome_t> outcomes;
+    std::size_t slice;
+
+  public:
+    static constexpr std::size_t unlimited = static_cast <std::size_t> (-1);
+
+    explicit scheduler (std::size_t s = 1000)
+      : ready {}
+      , outcomes {}
+      , slice {s} {}
+
+    // fuel を使い切った式は "out of fuel." で失敗にする. 返すのは outcome を引く番号
+    auto spawn (const environ_t & env , const expression & e , strategy s = strategy::strict , std::size_t fuel = unlimited) -> std::size_t {
+      auto id = outcomes.size ();
+      outcomes.push_back (outcome_t {task_state::running , value_t {} , {} , 0});
+      ready.push_back (task_t {id , machine {env , e , s} , fuel});
+      return id;
+    }
+
+    // 先頭の式を 1 切れだけ進めて, 終わっていなければ最後尾に回す. 待っている式が無ければ false
+    auto step () -> bool {
+      if (ready.empty ()) {
+        return false;
+      }
+      auto t = std::move (ready.front ());
+      ready.pop_front ();
+      auto & o = outcomes [t.id];
+      try {
+        auto used = t.m.advance (t.fuel < slice ? t.fuel : slice);
+        o.steps += used;
+        t.fuel -= t.fuel == unlimited ? 0 : used;
+        if (t.m.done ()) {
+          o.state = task_state::done;
+          o.value = t.m.result ();
+        }
+        else if (t.fuel == 0) {
+          o.state = task_state::failed;
+          o.error = "out of fuel.";
+        }
+        else {
+          ready.push_back (std::move (t));
+        }
+      }
+      catch (std::exception & e) {
+        o.state = task_state::failed;
+        o.error = e.what ();
+      }
+      return true;
+    }
+
+    auto run () {
+      while (step ()) {}
+    }
+
+    auto pending () const noexcept {
+      return ready.size ();
+    }
+
+    auto outcome (std::size_t id) const -> const outcome_t & {
+      return outcomes [id];
+    }
+  };
+}
+
+#endif // PRO_SCHEDULER_HPP
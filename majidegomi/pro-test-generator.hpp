@@ -0,0 +1,121 @@
+#ifndef PRO_TEST_GENERATOR_HPP
+#define PRO_TEST_GENERATOR_HPP
+#include <utility>
+#include <random>
+#include <string>
+#include <vector>
+#include "pro.hpp"
+
+// 評価器を比べるテストのための, 乱数で作る式. 束縛されていない名前, 0 除算, 関数でないものの適用などで失敗するものも混ぜる
+namespace test {
+  using integer = pro::int_value_t::value_type;
+
+  inline auto fib (integer n) -> pro::expression {
+    auto call = [] (integer d) {
+      return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+    };
+    return pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) ,
+      pro::Apply (pro::Var ("fib") , pro::Int (std::move (n))));
+  }
+
+  // 名前は少なくして, 束縛し直し (隠すこと) が起きやすいようにする
+  const char * const names [] = {"a" , "b" , "c" , "d"};
+
+  struct generator {
+    std::mt19937 random;
+
+    auto below (unsigned n) {
+      return static_cast <unsigned> (random () % n);
+    }
+
+    auto name () -> std::string {
+      return names [below (4)];
+    }
+
+    // scope は今見えている名前. たまに束縛されていない名前も使う
+    auto leaf (const std::vector <std::string> & scope) -> pro::expression {
+      switch (below (6)) {
+        case 0:
+          if (below (4) == 0) {
+            return pro::Void ();
+          }
+          return pro::Int (integer {below (100)});
+        case 1:
+        case 2:
+          if (! scope.empty ()) {
+            return pro::Var (scope [below (static_cast <unsigned> (scope.size ()))]);
+          }
+          return pro::Int (integer {below (5)});
+        case 3:
+          if (below (8) == 0) {
+            return pro::Var ("nope");
+          }
+          return pro::Int (integer {below (3)});
+        default:
+          return pro::Int (integer {below (10)});
+      }
+    }
+
+    auto make (int depth , const std::vector <std::string> & scope) -> pro::expression {
+      if (depth == 0) {
+        return leaf (scope);
+      }
+      auto sub = [&] {
+        return make (depth - 1 , scope);
+      };
+      auto under = [&] (const std::string & x) {
+        auto inner = scope;
+        inner.push_back (x);
+        return make (depth - 1 , inner);
+      };
+      switch (below (16)) {
+        case 0:
+          return pro::Add (sub () , sub ());
+        case 1:
+          return pro::Sub (sub () , sub ());
+        case 2:
+          return pro::Mul (sub () , sub ());
+        case 3:
+          return pro::Div (sub () , sub ());
+        case 4:
+          return pro::If (pro::Less (sub () , sub ()) , sub () , sub ());
+        case 5:
+          return pro::If (pro::Equal (sub () , sub ()) , sub () , sub ());
+        case 6: {
+          auto x = name ();
+          auto e = sub ();
+          return pro::Let (pro::Var (x) , std::move (e) , under (x));
+        }
+        case 7: {
+          auto x = name ();
+          auto body = under (x);
+          return pro::Apply (pro::Lambda (pro::Var (x) , std::move (body)) , sub ());
+        }
+        case 8:
+          // 閉じていて重い部分式. memo が覚える
+          return fib (integer {5 + below (8)});
+        case 9: {
+          auto x = name ();
+          std::vector <pro::clause_t> cs;
+          cs.push_back (pro::clause_t {pro::Int (integer {below (3)}) , sub ()});
+          cs.push_back (pro::clause_t {pro::Var (x) , under (x)});
+          return pro::Case (sub () , std::move (cs));
+        }
+        case 10:
+          return pro::Index (pro::Tuple ({sub () , sub ()}) , pro::Int (integer {below (3)}));
+        case 11:
+          return pro::Size (pro::Push (pro::Tuple ({sub ()}) , sub ()));
+        case 12:
+          if (below (4) == 0) {
+            // 関数でないものを適用して失敗する
+            return pro::Apply (sub () , sub ());
+          }
+          return pro::Apply (pro::Lambda (pro::Var ("x") , pro::Add (pro::Var ("x") , pro::Int (1))) , sub ());
+        default:
+          return sub ();
+      }
+    }
+  };
+}
+
+#endif // PRO_TEST_GENERATOR_HPP
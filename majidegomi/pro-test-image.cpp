@@ -0,0 +1,276 @@
+// g++ -std=c++14 -O2 pro-test-image.cpp && ./a.out
+// serialize した像を読んで run した結果が, 元の code_t を vm::run したものと同じかを確かめる.
+// 途中で切れた像, 知らない版の像, 添字が範囲の外にある像は, どれも実行する前に invalid image で断ること. 違えば 1 で終わる
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <unistd.h>
+#include "pro.hpp"
+#include "pro-arena.hpp"
+#include "pro-parser.hpp"
+#include "pro-vm.hpp"
+#include "pro-image.hpp"
+
+namespace test {
+  // 像を 8 バイト境界に写して持つ. std::string の中身は揃っているとは限らない
+  struct aligned {
+    std::vector <std::uint64_t> words;
+    std::size_t size;
+
+    explicit aligned (const std::string & bytes)
+      : words (bytes.size () / 8 + 1)
+      , size {bytes.size ()} {
+      std::memcpy (words.data () , bytes.data () , bytes.size ());
+    }
+
+    auto view () const {
+      return pro::vm::image_view {words.data () , size};
+    }
+  };
+
+  template <typename F>
+  inline auto shown (F f) -> std::string {
+    try {
+      auto v = f ();
+      return v.is (pro::object_kind::vm_closure) ? "closure" : pro::show (v);
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+
+  std::size_t failed = 0;
+
+  // 像として読めずに invalid image で断るか
+  inline auto rejects (const std::string & what , const std::string & bytes) {
+    auto got = shown ([&] {
+      aligned b {bytes};
+      return pro::vm::run (b.view ());
+    });
+    if (got.compare (0 , 16 , "E:invalid image:") != 0) {
+      std::cout << what << ": " << got << ", expected invalid image" << std::endl;
+      ++ failed;
+    }
+  }
+
+  template <typename T>
+  inline auto put (std::string & bytes , std::uint64_t offset , T x) {
+    std::memcpy (& bytes [offset] , & x , sizeof x);
+  }
+
+  inline auto header (const std::string & bytes) {
+    pro::vm::image_format::header_t h;
+    std::memcpy (& h , bytes.data () , sizeof h);
+    return h;
+  }
+
+  inline auto temporary () -> std::string {
+    char path [] = "/tmp/pro-test-image-XXXXXX";
+    auto fd = mkstemp (path);
+    if (fd < 0) {
+      throw std::runtime_error {"cannot create a temporary file."};
+    }
+    close (fd);
+    return path;
+  }
+}
+
+auto main () -> int {
+  using namespace pro;
+  namespace f = vm::image_format;
+  // input を引数にして, いくつかの入力で走らせる
+  const char * const sources [] = {
+    "42" ,
+    "()" ,
+    "input" ,
+    "(+ input 1)" ,
+    "9223372036854775807" ,
+    "-9223372036854775808" ,
+    "(let x 5 (* x input))" ,
+    "(letrec fib (lambda n (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib (+ input 10)))" ,
+    "(let add (lambda a (lambda b (+ a b))) ((add 3) input))" ,
+    "(lambda x (+ x input))" ,
+    "(case input (0 10) (3 30) (() 7) (n (* n n)))" ,
+    "(case input (0 10) (1000000 30) (-5000000000 7))" ,
+    "((function (0 1) (1 2) (2 5) (3 9) (k (* k 2))) input)" ,
+    "(let (tuple a b) (tuple input (tuple 1 2)) (index b a))" ,
+    "(size (push (update (tuple 1 2 3) 0 input) input))" ,
+    "(/ 1 input)" ,
+    "(let f (lambda x undefined_name) (f input))" ,
+    "(1 2)" ,
+    "(letrec loop (lambda n (if (== n 0) input (loop (- n 1)))) (loop 100000))" ,
+  };
+  const value_t inputs [] = {value_t {} , value_t::integer (0) , value_t::integer (1) , value_t::integer (3) , value_t::integer (-4)};
+  auto path = test::temporary ();
+  std::vector <std::string> images;
+  for (auto source : sources) {
+    program_t p;
+    auto code = vm::compile (parse (p , std::string {source}) , intern ("input"));
+    auto bytes = vm::serialize (code);
+    if (bytes != vm::serialize (code)) {
+      std::cout << source << ": serialize is not deterministic" << std::endl;
+      ++ test::failed;
+    }
+    images.push_back (bytes);
+    test::aligned b {bytes};
+    vm::save (code , path);
+    vm::mapped_image m {path};
+    for (auto && x : inputs) {
+      auto expect = test::shown ([&] { return vm::run (code , x); });
+      auto loaded = test::shown ([&] { return vm::run (b.view () , x); });
+      auto mapped = test::shown ([&] { return vm::run (m.view () , x); });
+      if (loaded != expect || mapped != expect) {
+        std::cout << source << " with " << show (x) << ": " << loaded << " , " << mapped << " , expected " << expect << std::endl;
+        ++ test::failed;
+      }
+    }
+    pro::collect ();
+  }
+  std::remove (path.c_str ());
+
+  for (std::size_t k = 0; k < images.size (); ++ k) {
+    auto & good = images [k];
+    auto what = [&] (const std::string & s) {
+      return std::string {sources [k]} + ": " + s;
+    };
+    auto h = test::header (good);
+
+    // どこで切れても断る
+    for (std::size_t n = 0; n < good.size (); ++ n) {
+      test::rejects (what ("truncated to " + std::to_string (n)) , good.substr (0 , n));
+    }
+
+    // 知らない版
+    for (std::uint32_t v : {std::uint32_t {0} , f::version + 1 , std::uint32_t {0xffffffff}}) {
+      auto s = good;
+      test::put (s , offsetof (f::header_t , version) , v);
+      test::rejects (what ("version " + std::to_string (v)) , s);
+    }
+
+    // 古い版の像として読ませる. その版に無い命令があれば断り, 無ければ同じように走る
+    for (auto v = f::oldest_version; v < f::version; ++ v) {
+      auto s = good;
+      test::put (s , offsetof (f::header_t , version) , v);
+      auto & code = h.sections [f::code];
+      auto newer = false;
+      for (std::uint64_t i = 0; i < code.count; ++ i) {
+        vm::instruction x;
+        std::memcpy (& x , & good [code.offset + i * sizeof x] , sizeof x);
+        newer = newer || f::first_version (x.op) > v;
+      }
+      if (newer) {
+        test::rejects (what ("version " + std::to_string (v) + " with newer opcodes") , s);
+      }
+      else {
+        test::aligned old {s} , now {good};
+        auto got = test::shown ([&] { return vm::run (old.view () , value_t::integer (3)); });
+        auto expect = test::shown ([&] { return vm::run (now.view () , value_t::integer (3)); });
+        if (got != expect) {
+          std::cout << what ("version " + std::to_string (v) + ": ") << got << " , expected " << expect << std::endl;
+          ++ test::failed;
+        }
+      }
+    }
+
+    // 配列の場所が像の外
+    for (std::size_t i = 0; i < f::section_count; ++ i) {
+      auto section = offsetof (f::header_t , sections) + i * sizeof (f::section_t);
+      auto s = good;
+      test::put (s , section + offsetof (f::section_t , count) , std::uint64_t {1} << 60);
+      test::rejects (what ("section " + std::to_string (i) + " count") , s);
+      s = good;
+      test::put (s , section + offsetof (f::section_t , offset) , h.size + 8);
+      test::rejects (what ("section " + std::to_string (i) + " offset") , s);
+    }
+
+    // 命令の添字. a を添字に使う命令はどれも範囲の外を断る
+    auto & code = h.sections [f::code];
+    for (std::uint64_t i = 0; i < code.count; ++ i) {
+      vm::instruction x;
+      std::memcpy (& x , & good [code.offset + i * sizeof x] , sizeof x);
+      auto at = code.offset + i * sizeof x;
+      switch (x.op) {
+        case vm::opcode::make_rec_closure:
+        case vm::opcode::dispatch: {
+          auto s = good;
+          test::put (s , at + offsetof (vm::instruction , b) , std::int64_t {0x7fffffff});
+          test::rejects (what ("instruction " + std::to_string (i) + " b") , s);
+        }
+          // fall through
+        case vm::opcode::make_closure:
+        case vm::opcode::load_local:
+        case vm::opcode::store_local:
+        case vm::opcode::match_void:
+        case vm::opcode::match_int:
+        case vm::opcode::match_tuple:
+        case vm::opcode::load_element:
+        case vm::opcode::load_captured:
+        case vm::opcode::jump:
+        case vm::opcode::jump_if_zero:
+        case vm::opcode::undefined:
+        case vm::opcode::primitive: {
+          auto s = good;
+          test::put (s , at + offsetof (vm::instruction , a) , std::uint32_t {0x7fffffff});
+          test::rejects (what ("instruction " + std::to_string (i) + " a") , s);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+    // 知らない命令
+    if (code.count != 0) {
+      auto s = good;
+      test::put (s , code.offset + offsetof (vm::instruction , op) , static_cast <vm::opcode> (0xff));
+      test::rejects (what ("unknown opcode") , s);
+    }
+
+    // 関数, 名前, case の表が指す範囲
+    auto & functions = h.sections [f::functions];
+    for (std::uint64_t i = 0; i < functions.count; ++ i) {
+      auto at = functions.offset + i * sizeof (vm::function_t);
+      auto s = good;
+      test::put (s , at + offsetof (vm::function_t , entry) , std::uint32_t {0x7fffffff});
+      test::rejects (what ("function " + std::to_string (i) + " entry") , s);
+      s = good;
+      test::put (s , at + offsetof (vm::function_t , capture_begin) , static_cast <std::uint32_t> (h.sections [f::captures].count + 1));
+      test::rejects (what ("function " + std::to_string (i) + " captures") , s);
+    }
+    auto & names = h.sections [f::names];
+    for (std::uint64_t i = 0; i < names.count; ++ i) {
+      auto s = good;
+      test::put (s , names.offset + i * sizeof (f::name_t) + offsetof (f::name_t , size) , h.sections [f::chars].count + 1);
+      test::rejects (what ("name " + std::to_string (i)) , s);
+    }
+    auto & tables = h.sections [f::tables];
+    for (std::uint64_t i = 0; i < tables.count; ++ i) {
+      auto at = tables.offset + i * sizeof (f::table_t);
+      auto s = good;
+      test::put (s , at + offsetof (f::table_t , dense_size) , static_cast <std::uint32_t> (h.sections [f::dense].count + 1));
+      test::rejects (what ("table " + std::to_string (i) + " dense") , s);
+      s = good;
+      test::put (s , at + offsetof (f::table_t , sparse_size) , static_cast <std::uint32_t> (h.sections [f::sparse].count + 1));
+      test::rejects (what ("table " + std::to_string (i) + " sparse") , s);
+      s = good;
+      test::put (s , at + offsetof (f::table_t , on_other) , std::uint32_t {0x7fffffff});
+      test::rejects (what ("table " + std::to_string (i) + " target") , s);
+    }
+  }
+
+  // 8 バイト境界にない像
+  {
+    test::aligned b {images [0] + std::string (8 , '\0')};
+    auto got = test::shown ([&] { return vm::run (vm::image_view {reinterpret_cast <const char *> (b.words.data ()) + 4 , images [0].size ()}); });
+    if (got.compare (0 , 16 , "E:invalid image:") != 0) {
+      std::cout << "unaligned: " << got << std::endl;
+      ++ test::failed;
+    }
+  }
+
+  std::cout << (test::failed ? "failed " : "ok ") << test::failed << std::endl;
+  return test::failed ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+// g++ -std=c++14 -O2 pro-test-incremental.cpp && ./a.out [seed]
+// 乱数で作った Let の入れ子を incremental_t に載せ, 束縛を乱数で差し替えながら value () を eval と比べる.
+// 値か失敗のメッセージが違えば 1 で終わる
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "pro.hpp"
+#include "pro-incremental.hpp"
+
+namespace test {
+  using integer = pro::int_value_t::value_type;
+
+  // 束縛の数と名前の数. 名前を使い回すので, 後の束縛が前の束縛を隠す
+  constexpr int bindings = 40;
+  constexpr int names = 25;
+
+  inline auto name (int i) -> std::string {
+    return "x" + std::to_string (i % names);
+  }
+
+  // safe なら束縛は全部整数になって失敗しない. そうでなければ関数や失敗する束縛も混ぜる
+  struct generator {
+    std::mt19937 random;
+    bool safe;
+
+    auto below (unsigned n) {
+      return static_cast <unsigned> (random () % n);
+    }
+
+    // i 番目の束縛から見える名前. たまに外の環境の名前か, どこにも無い名前を使う
+    auto reference (int i) -> pro::expression {
+      if (i == 0 || below (5) == 0) {
+        return pro::Var (safe || below (7) == 0 ? "outer" : "nope");
+      }
+      return pro::Var (name (static_cast <int> (below (static_cast <unsigned> (i)))));
+    }
+
+    auto binding (int i) -> pro::expression {
+      if (safe) {
+        switch (below (6)) {
+          case 0:
+            return pro::Int (integer {below (100)});
+          case 1:
+            return pro::Div (reference (i) , pro::Int (integer {1 + below (3)}));
+          case 2:
+            return pro::Apply (pro::Lambda (pro::Var ("a") , pro::Add (pro::Var ("a") , reference (i))) , pro::Int (2));
+          case 3:
+            return pro::If (reference (i) , reference (i) , pro::Int (1));
+          case 4:
+            return pro::Index (pro::Tuple ({reference (i) , pro::Int (integer {below (10)})}) , pro::Int (integer {below (2)}));
+          default:
+            return pro::Add (pro::Int (integer {below (5)}) , pro::Int (1));
+        }
+      }
+      switch (below (10)) {
+        case 0:
+          return pro::Int (integer {below (100)});
+        case 1:
+          // 1/3 は 0 除算
+          return pro::Div (pro::Int (10) , pro::Int (integer {below (3)}));
+        case 2:
+          return pro::Add (reference (i) , pro::Int (1));
+        case 3:
+          return pro::Mul (reference (i) , reference (i));
+        case 4:
+          return pro::Lambda (pro::Var ("a") , pro::Add (pro::Var ("a") , reference (i)));
+        case 5:
+          return pro::Apply (reference (i) , pro::Int (2));
+        case 6:
+          return pro::If (reference (i) , pro::Int (1) , reference (i));
+        case 7:
+          return pro::Index (pro::Tuple ({reference (i) , pro::Int (integer {below (10)})}) , pro::Int (integer {below (3)}));
+        default:
+          // 値が変わらない差し替え. その先へは広がらない
+          return pro::Add (pro::Int (integer {below (5)}) , pro::Int (1));
+      }
+    }
+  };
+
+  template <typename F>
+  inline auto shown (F f) -> std::string {
+    try {
+      return pro::show (f ());
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+}
+
+auto main (int argc , char ** argv) -> int {
+  auto seed = argc > 1 ? static_cast <unsigned> (std::strtoul (argv [1] , nullptr , 10)) : 1u;
+  test::generator g {std::mt19937 {seed} , false};
+  auto outer = pro::extend (pro::environ_t {} , pro::intern ("outer") , pro::value_t::integer (7));
+  std::size_t failed = 0;
+  std::size_t checks = 0;
+  std::size_t failures = 0;
+  for (int t = 0; t < 300; ++ t) {
+    g.safe = t % 2 == 0;
+    pro::expression e = pro::Add (pro::Var (test::name (static_cast <int> (g.below (test::bindings)))) , pro::Var (test::name (static_cast <int> (g.below (test::bindings)))));
+    for (int i = test::bindings; i -- > 0;) {
+      e = pro::Let (pro::Var (test::name (i)) , g.binding (i) , std::move (e));
+    }
+    pro::incremental_t inc {outer , e};
+    for (int step = 0; step < 12; ++ step) {
+      auto got = test::shown ([&] { return inc.value (); });
+      auto expect = test::shown ([&] { return pro::eval (outer , inc.program ()); });
+      // 差し替える前なら元の式とも同じ
+      if (step == 0) {
+        auto original = test::shown ([&] { return pro::eval (outer , e); });
+        if (original != expect) {
+          std::cout << "seed " << seed << " trial " << t << ": program () " << expect << " , original " << original << std::endl;
+          ++ failed;
+        }
+      }
+      if (got != expect) {
+        std::cout << "seed " << seed << " trial " << t << " step " << step << ": " << got << " , expected " << expect << std::endl;
+        ++ failed;
+      }
+      ++ checks;
+      failures += expect.compare (0 , 2 , "E:") == 0;
+      for (int k = 0; k < 3; ++ k) {
+        auto i = static_cast <int> (g.below (test::bindings));
+        inc.rebind (static_cast <std::size_t> (i) , g.binding (i));
+      }
+    }
+  }
+  std::cout << checks << " checks, " << failures << " fail" << std::endl;
+  if (failures == 0 || failures == checks) {
+    std::cout << "the generator does not mix failures and values" << std::endl;
+    ++ failed;
+  }
+
+  // 値が変わらなければ, 使っている束縛は評価し直さない
+  auto e = pro::Let (pro::Var ("a") , pro::Int (1) , pro::Let (pro::Var ("b") , pro::Add (pro::Var ("a") , pro::Int (1)) , pro::Let (pro::Var ("c") , pro::Int (5) , pro::Add (pro::Var ("b") , pro::Var ("c")))));
+  pro::incremental_t inc {pro::environ_t {} , e};
+  inc.value ();
+  auto before = inc.evaluations ();
+  inc.rebind (0 , pro::Add (pro::Int (0) , pro::Int (1)));
+  if (inc.value ().as_int () != 7 || inc.evaluations () != before + 1) {
+    std::cout << "an unchanged value was propagated: " << inc.evaluations () - before << " evaluations" << std::endl;
+    ++ failed;
+  }
+
+  std::cout << (failed ? "failed " : "ok ") << failed << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+// g++ -std=c++14 -O2 pro-test-memo.cpp && ./a.out [seed]
+// 乱数で作った式を eval と memo_eval で評価して, 値か失敗のメッセージが同じかを確かめる. 違えば 1 で終わる.
+// memo は新しいもの, 同じ式でもう一度使うもの, 全部の式で使い回すものの 3 通り. hashcons_t で共有した木でも比べる
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "pro.hpp"
+#include "pro-hashcons.hpp"
+#include "pro-test-generator.hpp"
+
+namespace test {
+  template <typename F>
+  inline auto shown (F f) -> std::string {
+    try {
+      return pro::show (f ());
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+}
+
+auto main (int argc , char ** argv) -> int {
+  auto seed = argc > 1 ? static_cast <unsigned> (std::strtoul (argv [1] , nullptr , 10)) : 1u;
+  test::generator g {std::mt19937 {seed}};
+  // 全部の式で共有する. 同じ形の fib はどの式でも同じノードになって, 覚えた値を使い回す
+  pro::hashcons_t h;
+  pro::memo_t shared;
+  std::size_t failed = 0;
+  std::size_t failures = 0;
+  constexpr int trials = 3000;
+  for (int t = 0; t < trials; ++ t) {
+    auto e = g.make (1 + t % 6 , {});
+    auto s = h.share (e);
+    pro::memo_t fresh;
+    auto expect = test::shown ([&] { return pro::eval (pro::environ_t {} , e); });
+    std::string got [] = {
+      test::shown ([&] { return pro::memo_eval (fresh , pro::environ_t {} , e); }) ,
+      test::shown ([&] { return pro::memo_eval (fresh , pro::environ_t {} , e); }) ,
+      test::shown ([&] { return pro::memo_eval (shared , pro::environ_t {} , s); }) ,
+      test::shown ([&] { return pro::eval (pro::environ_t {} , s); }) ,
+    };
+    for (auto && x : got) {
+      if (x != expect) {
+        std::cout << "seed " << seed << " trial " << t << ": " << x << " , expected " << expect << std::endl;
+        ++ failed;
+      }
+    }
+    failures += expect.compare (0 , 2 , "E:") == 0;
+  }
+  // 失敗するものも成功するものも十分に混ざっていること
+  std::cout << trials << " expressions, " << failures << " fail, memo " << shared.hits () << " hits " << shared.misses () << " misses" << std::endl;
+  if (failures == 0 || failures == trials) {
+    std::cout << "the generator does not mix failures and values" << std::endl;
+    ++ failed;
+  }
+
+  // 末尾呼び出しが 10^6 回続いてもネイティブスタックは伸びない. 最後の値は閉じた部分式で, 覚えた値を使う
+  for (auto last : {pro::expression {pro::Int (7)} , test::fib (10)}) {
+    auto body = pro::If (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , std::move (last));
+    auto e = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , std::move (body)) , pro::Apply (pro::Var ("loop") , pro::Int (1000000)));
+    auto expect = test::shown ([&] { return pro::eval (pro::environ_t {} , e); });
+    pro::memo_t memo;
+    auto got = test::shown ([&] { return pro::memo_eval (memo , pro::environ_t {} , e); });
+    if (got != expect) {
+      std::cout << "deep loop: " << got << " , expected " << expect << std::endl;
+      ++ failed;
+    }
+  }
+
+  std::cout << (failed ? "failed " : "ok ") << failed << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+// g++ -std=c++14 -O2 -pthread -DPRO_ATOMIC_REFCOUNT pro-test-parallel.cpp && ./a.out [seed]
+// データ競合は g++ -std=c++14 -O1 -g -fsanitize=thread -pthread -DPRO_ATOMIC_REFCOUNT pro-test-parallel.cpp && ./a.out で調べる
+// 乱数で作った式を eval と parallel_eval で評価して, 値か失敗のメッセージが同じかを確かめる. 違えば 1 で終わる.
+// grain を 1 にしてできるだけ fork させるものと, 既定の grain のものを比べる
+#include <iostream>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include "pro.hpp"
+#include "pro-parallel.hpp"
+#include "pro-test-generator.hpp"
+
+namespace test {
+  template <typename F>
+  inline auto shown (F f) -> std::string {
+    try {
+      return pro::show (f ());
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+}
+
+auto main (int argc , char ** argv) -> int {
+  auto seed = argc > 1 ? static_cast <unsigned> (std::strtoul (argv [1] , nullptr , 10)) : 1u;
+  test::generator g {std::mt19937 {seed}};
+  std::size_t failed = 0;
+  std::size_t failures = 0;
+  constexpr int trials = 3000;
+  for (std::size_t n : {2 , 4}) {
+    pro::fork_join_pool pool {n};
+    for (int t = 0; t < trials; ++ t) {
+      auto e = g.make (1 + t % 6 , {});
+      auto expect = test::shown ([&] { return pro::eval (pro::environ_t {} , e); });
+      for (std::uint32_t grain : {1u , 64u}) {
+        auto got = test::shown ([&] { return pro::parallel_eval (pool , pro::environ_t {} , e , grain); });
+        if (got != expect) {
+          std::cout << "seed " << seed << " trial " << t << ", " << n << " threads, grain " << grain << ": " << got << " , expected " << expect << std::endl;
+          ++ failed;
+        }
+      }
+      failures += expect.compare (0 , 2 , "E:") == 0;
+    }
+  }
+  std::cout << 2 * trials << " expressions, " << failures << " fail" << std::endl;
+  if (failures == 0 || failures == 2 * trials) {
+    std::cout << "the generator does not mix failures and values" << std::endl;
+    ++ failed;
+  }
+
+  pro::fork_join_pool pool {4};
+  // 関数でないものの適用は, 引数を評価する前に失敗する (引数が失敗しても, 終わらなくても)
+  auto forever = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Var ("n"))) , pro::Apply (pro::Var ("loop") , pro::Int (0)));
+  for (auto && e : {pro::Apply (pro::Int (1) , pro::Div (pro::Int (1) , pro::Int (0))) , pro::Apply (pro::Int (1) , std::move (forever))}) {
+    auto got = test::shown ([&] { return pro::parallel_eval (pool , pro::environ_t {} , e , 1); });
+    if (got != "E:the object <which is not a function> cannot apply.") {
+      std::cout << "applying a non-function: " << got << std::endl;
+      ++ failed;
+    }
+  }
+
+  // 末尾呼び出しが 10^6 回続いてもネイティブスタックは伸びない
+  auto body = pro::If (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Int (7));
+  auto deep = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , std::move (body)) , pro::Apply (pro::Var ("loop") , pro::Int (1000000)));
+  auto got = test::shown ([&] { return pro::parallel_eval (pool , pro::environ_t {} , deep , 1); });
+  if (got != "7") {
+    std::cout << "deep loop: " << got << std::endl;
+    ++ failed;
+  }
+
+  std::cout << (failed ? "failed " : "ok ") << failed << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+// g++ -std=c++14 -O2 pro-test-parser.cpp && ./a.out
+// 読んだ木がビルダーで作った木と同じ形か, 読めない入力がどれも決まったメッセージで失敗するかを確かめる. 違えば 1 で終わる
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+#include "pro.hpp"
+#include "pro-arena.hpp"
+#include "pro-hashcons.hpp"
+#include "pro-parser.hpp"
+
+namespace test {
+  using pro::ref;
+
+  // 形が同じか. ノードが別でも, 種類と中身が同じなら同じとみなす
+  inline auto same (const pro::expression & a , const pro::expression & b) -> bool;
+
+  struct same_f {
+    const pro::expression & other;
+
+    template <typename T>
+    auto operator () (const ref <T> & p) const -> bool {
+      auto q = boost::get <ref <T>> (& other);
+      return q && equal (* p , * * q);
+    }
+
+    static auto equal (const pro::void_value_t & , const pro::void_value_t &) {
+      return true;
+    }
+
+    static auto equal (const pro::int_value_t & p , const pro::int_value_t & q) {
+      return p.data == q.data;
+    }
+
+    static auto equal (const pro::var_t & p , const pro::var_t & q) {
+      return p.name == q.name;
+    }
+
+    static auto equal (const pro::lambda_t & p , const pro::lambda_t & q) {
+      return same (p.arg , q.arg) && same (p.body , q.body);
+    }
+
+    static auto equal (const pro::apply_t & p , const pro::apply_t & q) {
+      return same (p.func , q.func) && same (p.expr , q.expr);
+    }
+
+    static auto equal (const pro::letrec_t & p , const pro::letrec_t & q) {
+      return p.name == q.name && same (pro::expression {p.func} , pro::expression {q.func}) && same (p.body , q.body);
+    }
+
+    static auto equal (const pro::prim_t & p , const pro::prim_t & q) {
+      return p.op == q.op && same (p.lhs , q.lhs) && same (p.rhs , q.rhs);
+    }
+
+    static auto equal (const pro::if_t & p , const pro::if_t & q) {
+      return same (p.test , q.test) && same (p.consequent , q.consequent) && same (p.alternative , q.alternative);
+    }
+
+    static auto equal (const pro::match_t & p , const pro::match_t & q) {
+      if (! same (p.scrutinee , q.scrutinee) || p.clauses.size () != q.clauses.size ()) {
+        return false;
+      }
+      for (std::size_t i = 0; i < p.clauses.size (); ++ i) {
+        if (! same (p.clauses [i].pattern , q.clauses [i].pattern) || ! same (p.clauses [i].body , q.clauses [i].body)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    static auto equal (const pro::tuple_t & p , const pro::tuple_t & q) {
+      if (p.elements.size () != q.elements.size ()) {
+        return false;
+      }
+      for (std::size_t i = 0; i < p.elements.size (); ++ i) {
+        if (! same (p.elements [i] , q.elements [i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  inline auto same (const pro::expression & a , const pro::expression & b) -> bool {
+    return boost::apply_visitor (same_f {b} , a);
+  }
+
+  std::size_t failed = 0;
+
+  // program_t と hashcons_t の両方で読んで, expect と同じ形か
+  inline auto parses (const std::string & source , const pro::expression & expect) {
+    {
+      pro::program_t p;
+      if (! same (pro::parse (p , source) , expect)) {
+        std::cout << "program_t: " << source << " differs from the builder tree" << std::endl;
+        ++ failed;
+      }
+    }
+    pro::hashcons_t h;
+    if (! same (pro::parse (h , source) , expect)) {
+      std::cout << "hashcons_t: " << source << " differs from the builder tree" << std::endl;
+      ++ failed;
+    }
+  }
+
+  // 読めずに, message を含むメッセージで失敗するか
+  template <typename F>
+  inline auto rejects (const std::string & what , const std::string & message , F f) {
+    try {
+      f ();
+      std::cout << what << ": parsed, expected '" << message << "'" << std::endl;
+    }
+    catch (std::exception & e) {
+      if (std::string {e.what ()} .find (message) != std::string::npos) {
+        return;
+      }
+      std::cout << what << ": '" << e.what () << "', expected '" << message << "'" << std::endl;
+    }
+    ++ failed;
+  }
+
+  inline auto rejects (const std::string & source , const std::string & message) {
+    rejects ("'" + source + "'" , message , [&] {
+      pro::program_t p;
+      pro::parse (p , source);
+    });
+  }
+
+  inline auto temporary (const std::string & content) -> std::string {
+    char path [] = "/tmp/pro-test-parser-XXXXXX";
+    auto fd = mkstemp (path);
+    if (fd < 0) {
+      throw std::runtime_error {"cannot create a temporary file."};
+    }
+    close (fd);
+    std::ofstream {path} << content;
+    return path;
+  }
+}
+
+auto main () -> int {
+  using namespace pro;
+  using test::parses;
+  using test::rejects;
+
+  parses ("42" , Int (42));
+  parses ("-7" , Int (-7));
+  parses ("9223372036854775807" , Int (9223372036854775807));
+  parses ("-9223372036854775808" , Int (-9223372036854775807 - 1));
+  parses ("()" , Void ());
+  parses ("x'" , Var ("x'"));
+  parses ("(+ 1 2)" , Add (Int (1) , Int (2)));
+  parses ("(<= a (% b 3))" , LessEqual (Var ("a") , Mod (Var ("b") , Int (3))));
+  parses ("(!= (== 1 2) (>= 3 (> 4 5)))" , NotEqual (Equal (Int (1) , Int (2)) , GreaterEqual (Int (3) , Greater (Int (4) , Int (5)))));
+  parses ("(lambda x (* x x))" , Lambda (Var ("x") , Mul (Var ("x") , Var ("x"))));
+  parses ("(f a b c)" , Apply (Apply (Apply (Var ("f") , Var ("a")) , Var ("b")) , Var ("c")));
+  parses ("(let x 5 (- x 1))" , Let (Var ("x") , Int (5) , Sub (Var ("x") , Int (1))));
+  parses ("(let () () 1)" , Let (Void () , Void () , Int (1)));
+  parses ("(letrec f (lambda n (f n)) (f 0))" , LetRec (Var ("f") , Lambda (Var ("n") , Apply (Var ("f") , Var ("n"))) , Apply (Var ("f") , Int (0))));
+  parses ("(if t (/ 1 t) 0)" , If (Var ("t") , Div (Int (1) , Var ("t")) , Int (0)));
+  parses ("(case n (0 1) (() 2) (k k))" , Case (Var ("n") , {{Int (0) , Int (1)} , {Void () , Int (2)} , {Var ("k") , Var ("k")}}));
+  parses ("(function (0 1) (k (* k 2)))" , Function ({{Int (0) , Int (1)} , {Var ("k") , Mul (Var ("k") , Int (2))}}));
+  parses ("(let (tuple a b) (tuple 1 (tuple)) a)" , Let (Tuple ({Var ("a") , Var ("b")}) , Tuple ({Int (1) , Tuple ({})}) , Var ("a")));
+  parses ("(update (push v 1) (size v) (index v 0))" , Update (Push (Var ("v") , Int (1)) , Size (Var ("v")) , Index (Var ("v") , Int (0))));
+  parses ("; comment\n(let x' 1 ; inline\n  x')\n; trailing" , Let (Var ("x'") , Int (1) , Var ("x'")));
+  parses ("  \t\n(\n+\n1\n2\n)\n" , Add (Int (1) , Int (2)));
+
+  // 括弧の釣り合い
+  rejects ("(+ 1 2" , "missing ')'");
+  rejects ("((lambda x x) 1" , "missing ')'");
+  rejects ("(+ 1 2))" , "unexpected ')'");
+  rejects (")" , "unexpected ')'");
+  rejects ("1 2" , "more than one expression");
+  // 読めない字句
+  rejects ("12a" , "invalid integer '12a'");
+  rejects ("9223372036854775808" , "out of range");
+  rejects ("-9223372036854775809" , "out of range");
+  rejects ("@" , "parse error");
+  rejects ("(+ 1 #)" , "parse error");
+  rejects ("%case" , "invalid name '%case'");
+  // 空
+  rejects ("" , "no expression");
+  rejects ("  \n\t " , "no expression");
+  rejects ("; only a comment" , "no expression");
+  // 形の誤り
+  rejects ("(let x 1)" , "let takes 3 expressions");
+  rejects ("(if 1 2)" , "if takes 3 expressions");
+  rejects ("(f)" , "an application needs an argument");
+  rejects ("(let let 1 2)" , "'let' can be used only at the head of a form");
+  rejects ("(case 1 2)" , "a clause must be (pattern body)");
+  rejects ("(function (0 1) 3)" , "a clause must be (pattern body)");
+  rejects ("(case 1 ((lambda a a) 2))" , "case clauses match only Int, Void or a variable");
+  rejects ("(letrec f 1 f)" , "letrec binds only a variable to a lambda");
+  // 行番号は誤りのあった行
+  rejects ("(\n\n(lambda x x)\n 1 2 3 (if))" , "at line 4");
+
+  // ファイルから
+  auto ok = test::temporary ("(letrec sum (lambda n (if n (+ n (sum (- n 1))) 0)) (sum 100))\n");
+  {
+    program_t p;
+    auto e = parse_file (p , ok);
+    auto expect = LetRec (Var ("sum") , Lambda (Var ("n") , If (Var ("n") , Add (Var ("n") , Apply (Var ("sum") , Sub (Var ("n") , Int (1)))) , Int (0))) , Apply (Var ("sum") , Int (100)));
+    if (! test::same (e , expect)) {
+      std::cout << "parse_file differs from the builder tree" << std::endl;
+      ++ test::failed;
+    }
+  }
+  auto empty = test::temporary ("");
+  rejects ("an empty file" , "no expression" , [&] {
+    program_t p;
+    parse_file (p , empty);
+  });
+  rejects ("a missing file" , "cannot open" , [&] {
+    program_t p;
+    parse_file (p , "/tmp/pro-test-parser-missing/none.pro");
+  });
+  std::remove (ok.c_str ());
+  std::remove (empty.c_str ());
+
+  // 入れ子が深くてもネイティブスタックを使わない
+  std::string deep;
+  for (int i = 0; i < 300000; ++ i) {
+    deep += "(+ 1 ";
+  }
+  deep += "0";
+  deep.append (300000 , ')');
+  {
+    program_t p;
+    parse (p , deep);
+    if (p.node_count () != 600001) {
+      std::cout << "deep: " << p.node_count () << " nodes" << std::endl;
+      ++ test::failed;
+    }
+  }
+
+  std::cout << (test::failed ? "failed " : "ok ") << test::failed << std::endl;
+  return test::failed ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+// g++ -std=c++14 -O2 -pthread pro-test-pool.cpp && ./a.out
+// データ競合は g++ -std=c++14 -O1 -g -fsanitize=thread -pthread pro-test-pool.cpp && ./a.out で調べる
+// (-DPRO_ATOMIC_REFCOUNT を付けても通ること)
+// pool::evaluate の結果が, 同じジョブを 1 本のスレッドで vm::run したものと同じかを確かめる. 違えば 1 で終わる
+#include <iostream>
+#include <string>
+#include <vector>
+#include "pro.hpp"
+#include "pro-vm.hpp"
+#include "pro-pool.hpp"
+
+namespace test {
+  using integer = pro::int_value_t::value_type;
+
+  // fib input
+  inline auto fib () -> pro::expression {
+    auto call = [] (integer d) {
+      return pro::Apply (pro::Var ("fib") , pro::Sub (pro::Var ("n") , pro::Int (std::move (d))));
+    };
+    return pro::LetRec (pro::Var ("fib") , pro::Lambda (pro::Var ("n") , pro::If (pro::Less (pro::Var ("n") , pro::Int (2)) , pro::Var ("n") , pro::Add (call (1) , call (2)))) ,
+      pro::Apply (pro::Var ("fib") , pro::Var ("input")));
+  }
+
+  // 一回りごとにクロージャを作って捨てる. letrec の自己参照で循環もできる
+  inline auto closures () -> pro::expression {
+    auto step = pro::Apply (pro::Apply (pro::Var ("loop") , pro::Sub (pro::Var ("n") , pro::Int (1))) , pro::Add (pro::Var ("acc") , pro::Apply (pro::Lambda (pro::Var ("z") , pro::Var ("n")) , pro::Void ())));
+    return pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Lambda (pro::Var ("acc") , pro::If (pro::Var ("n") , std::move (step) , pro::Mul (pro::Var ("acc") , pro::Int (integer {1} << 40))))) ,
+      pro::Apply (pro::Apply (pro::Var ("loop") , pro::Var ("input")) , pro::Int (0)));
+  }
+
+  // 結果を比べられる文字列にする. 関数は pool からは持ち出せないので undefined と同じに扱う
+  inline auto sequential (const pro::job_t & j) -> std::string {
+    try {
+      auto v = pro::vm::run (* j.program , j.input);
+      return v.is (pro::object_kind::vm_closure) ? "undefined" : pro::show (v);
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+
+  inline auto parallel (const pro::job_result_t & r) -> std::string {
+    return r.error.empty () ? (r.value.is_undefined () ? "undefined" : pro::show (r.value)) : "E:" + r.error;
+  }
+}
+
+auto main () -> int {
+  auto input = pro::intern ("input");
+  auto a = pro::vm::compile (test::fib () , input);
+  auto b = pro::vm::compile (test::closures () , input);
+  auto c = pro::vm::compile (pro::Lambda (pro::Var ("x") , pro::Var ("input")) , input);
+  auto d = pro::vm::compile (pro::Div (pro::Int (1) , pro::Var ("input")) , input);
+  std::vector <pro::job_t> jobs;
+  for (int i = 0; i < 200; ++ i) {
+    jobs.push_back (pro::job_t {& a , pro::value_t::integer (i % 18)});
+    jobs.push_back (pro::job_t {& b , pro::value_t::integer (i * 10)});
+    // i % 3 == 0 は 0 除算で失敗する
+    jobs.push_back (pro::job_t {& d , pro::value_t::integer (i % 3)});
+  }
+  jobs.push_back (pro::job_t {& c , pro::value_t::integer (1)});
+  jobs.push_back (pro::job_t {& a , pro::value_t {}});
+  std::vector <std::string> expect;
+  for (auto && j : jobs) {
+    expect.push_back (test::sequential (j));
+  }
+
+  std::size_t failed = 0;
+  for (std::size_t n : {1 , 2 , 4 , 8}) {
+    pro::pool p {n};
+    for (int round = 0; round < 3; ++ round) {
+      auto rs = p.evaluate (jobs);
+      if (rs.size () != jobs.size ()) {
+        std::cout << n << " threads: " << rs.size () << " results for " << jobs.size () << " jobs" << std::endl;
+        ++ failed;
+        continue;
+      }
+      for (std::size_t i = 0; i < rs.size (); ++ i) {
+        auto got = test::parallel (rs [i]);
+        if (got != expect [i]) {
+          std::cout << n << " threads, job " << i << ": " << got << " , expected " << expect [i] << std::endl;
+          ++ failed;
+        }
+      }
+    }
+  }
+
+  // 整数と () 以外は渡せない. 空のバッチもすぐ返る
+  pro::pool p {2};
+  std::vector <pro::job_t> closure_input {pro::job_t {& a , pro::value_t {pro::make <pro::vm::closure_t> (0u , std::vector <pro::value_t> {})}}};
+  if (p.evaluate (closure_input) [0].error.empty ()) {
+    std::cout << "a closure was passed to a job" << std::endl;
+    ++ failed;
+  }
+  if (! p.evaluate ({}).empty ()) {
+    std::cout << "an empty batch returned results" << std::endl;
+    ++ failed;
+  }
+
+  std::cout << (failed ? "failed " : "ok ") << failed << std::endl;
+  return failed ? 1 : 0;
+}
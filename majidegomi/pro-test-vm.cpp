@@ -0,0 +1,60 @@
+// g++ -std=c++14 -O2 pro-test-vm.cpp && ./a.out [seed]
+// 乱数で作った式を eval と vm::run (vm::compile (e)) で評価して, 値か失敗のメッセージが同じかを確かめる. 違えば 1 で終わる.
+// 関数でないものの適用は, 引数を評価する前に失敗すること (引数が失敗しても, 終わらなくても)
+#include <iostream>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include "pro.hpp"
+#include "pro-vm.hpp"
+#include "pro-test-generator.hpp"
+
+namespace test {
+  // 関数はエンジンごとに形が違うので, 関数であることだけを比べる
+  template <typename F>
+  inline auto shown (F f) -> std::string {
+    try {
+      auto v = f ();
+      return v.is (pro::object_kind::closure) || v.is (pro::object_kind::vm_closure) ? "function" : pro::show (v);
+    }
+    catch (std::exception & e) {
+      return std::string {"E:"} + e.what ();
+    }
+  }
+}
+
+auto main (int argc , char ** argv) -> int {
+  auto seed = argc > 1 ? static_cast <unsigned> (std::strtoul (argv [1] , nullptr , 10)) : 1u;
+  test::generator g {std::mt19937 {seed}};
+  std::size_t failed = 0;
+  std::size_t failures = 0;
+  constexpr int trials = 5000;
+  for (int t = 0; t < trials; ++ t) {
+    auto e = g.make (1 + t % 6 , {});
+    auto expect = test::shown ([&] { return pro::eval (pro::environ_t {} , e); });
+    auto got = test::shown ([&] { return pro::vm::run (pro::vm::compile (e)); });
+    if (got != expect) {
+      std::cout << "seed " << seed << " trial " << t << ": " << got << " , expected " << expect << std::endl;
+      ++ failed;
+    }
+    failures += expect.compare (0 , 2 , "E:") == 0;
+  }
+  std::cout << trials << " expressions, " << failures << " fail" << std::endl;
+  if (failures == 0 || failures == trials) {
+    std::cout << "the generator does not mix failures and values" << std::endl;
+    ++ failed;
+  }
+
+  // 失敗する引数や終わらない引数を関数でないものに適用しても, 関数でないことで失敗する (直す前は最後のものが終わらない)
+  auto loop = pro::LetRec (pro::Var ("loop") , pro::Lambda (pro::Var ("n") , pro::Apply (pro::Var ("loop") , pro::Var ("n"))) , pro::Apply (pro::Var ("loop") , pro::Int (0)));
+  for (auto && e : {pro::Apply (pro::Int (1) , pro::Div (pro::Int (1) , pro::Int (0))) , pro::Apply (pro::Int (1) , std::move (loop))}) {
+    auto got = test::shown ([&] { return pro::vm::run (pro::vm::compile (e)); });
+    if (got != "E:the object <which is not a function> cannot apply.") {
+      std::cout << "applying a non-function: " << got << std::endl;
+      ++ failed;
+    }
+  }
+
+  std::cout << (failed ? "failed " : "ok ") << failed << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,595 @@
+#ifndef PRO_VM_HPP
+#define PRO_VM_HPP
+#include <utility>
+#include <sstream>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <iterator>
+#include <stdexcept>
+#include "pro.hpp"
+
+// pro の式をバイトコードにコンパイルしてスタック VM で実行する.
+// 変数はコンパイル時にスロット番号へ解決され, クロージャは自由変数だけを平坦な配列に捕獲する.
+namespace pro { namespace vm {
+  enum class opcode : std::uint8_t {
+    push_void ,     //                 -> ()
+    push_int ,      // b               -> b
+    load_local ,    // a               -> locals [a]
+    load_captured , // a               -> captured [a]
+    store_local ,   // a  x            ->            (locals [a] = x)
+    match_void ,    // a               -> ()         locals [a] が () でなければ失敗
+    match_int ,     // a b             -> ()         locals [a] が b でなければ失敗
+    make_closure ,  // a               -> closure    functions [a] を現在のフレームで閉じる
+    make_rec_closure , // a b          -> closure    make_closure と同じ. ただし locals [b] を捕獲するところには自分自身を入れる
+    call ,          //    f x          -> f (x)
+    tail_call ,     //    f x          -> f (x)      今のフレームを f に明け渡す
+    primitive ,     // a  x y          -> x a y      a は pro::primitive
+    jump ,          // a               ->            pc = a
+    jump_if_zero ,  // a  x            ->            x が 0 なら pc = a
+    dispatch ,      // a b             ->            pc = tables [a] で locals [b] を引いた先
+    ret ,           //    x            -> (呼び出し元へ)
+    undefined ,     // a               -> (names [a] is undefined.)
+    halt ,          //    x            -> (run を終了)
+    make_tuple ,    // a  x ...        -> (tuple x ...)  上の a 個を並べたベクタ
+    match_tuple ,   // a b             -> ()         locals [a] が長さ b のベクタでなければ失敗
+    load_element ,  // a b             -> locals [a] の b 番目
+    check_function , //   f            -> f          f が関数でなければ失敗
+  };
+
+  struct instruction {
+    opcode op;
+    std::uint32_t a;
+    std::int64_t b;
+  };
+
+  // 捕獲する値の取り出し元. 外側のフレームの local か, 外側のクロージャの captured.
+  struct capture_t {
+    bool local;
+    std::uint32_t index;
+  };
+
+  struct function_t {
+    std::uint32_t entry;
+    std::uint32_t locals;
+    std::uint32_t capture_begin;
+    std::uint32_t capture_count;
+  };
+
+  // functions [0] がトップレベル. tables の行き先はコードの位置
+  struct code_t {
+    std::vector <instruction> code;
+    std::vector <function_t> functions;
+    std::vector <capture_t> captures;
+    std::vector <std::string> names;
+    std::vector <case_table_t> tables;
+  };
+
+
+  // 値は pro::value_t をそのまま使う. VM のクロージャは関数の番号と捕獲した値だけを持つ
+  struct closure_t : object_t {
+    std::uint32_t function;
+    std::vector <value_t> captured;
+
+    closure_t (std::uint32_t f , std::vector <value_t> && c)
+      : object_t {object_kind::vm_closure}
+      , function {f}
+      , captured {std::move (c)} {}
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      for (auto && v : captured) {
+        pro::detail::push_child (v , out);
+      }
+    }
+
+    auto clear () -> void override {
+      captured.clear ();
+    }
+  };
+
+
+  namespace detail {
+    // コンパイル中の関数 1 つ分. 外側の関数へのポインタを持つ.
+    struct scope_t {
+      scope_t * parent;
+      std::uint32_t function;
+      std::vector <std::pair <symbol , std::uint32_t>> locals;
+      std::uint32_t local_count;
+      std::vector <std::pair <symbol , capture_t>> captures;
+
+      scope_t (scope_t * p , std::uint32_t f)
+        : parent {p}
+        , function {f}
+        , locals {}
+        , local_count {0}
+        , captures {} {}
+
+      auto new_local () {
+        return local_count ++;
+      }
+
+      // 見つかれば {local か , 番号} を返す
+      auto resolve (symbol name) -> std::pair <bool , capture_t> {
+        for (auto ite = locals.rbegin (); ite != locals.rend (); ++ ite) {
+          if (ite -> first == name) {
+            return {true , capture_t {true , ite -> second}};
+          }
+        }
+        for (std::uint32_t i = 0; i < captures.size (); ++ i) {
+          if (captures [i].first == name) {
+            return {true , capture_t {false , i}};
+          }
+        }
+        if (parent) {
+          auto r = parent -> resolve (name);
+          if (r.first) {
+            captures.emplace_back (name , r.second);
+            return {true , capture_t {false , static_cast <std::uint32_t> (captures.size () - 1)}};
+          }
+        }
+        return {false , capture_t {}};
+      }
+    };
+
+    struct compiler {
+      code_t & out;
+      scope_t * scope;
+      std::vector <instruction> * body;
+
+      auto emit (opcode op , std::uint32_t a = 0 , std::int64_t b = 0) {
+        body -> push_back (instruction {op , a , b});
+      }
+
+      auto name_index (symbol name) {
+        auto & s = name_of (name);
+        for (std::uint32_t i = 0; i < out.names.size (); ++ i) {
+          if (out.names [i] == s) {
+            return i;
+          }
+        }
+        out.names.push_back (s);
+        return static_cast <std::uint32_t> (out.names.size () - 1);
+      }
+
+      auto compile (const expression & e) -> void {
+        boost::apply_visitor (* this , e);
+      }
+
+      // locals [slot] に入っている値を pattern に照合する
+      auto compile_pattern (const expression & pattern , std::uint32_t slot) -> void {
+        if (auto p = boost::get <ref <var_t>> (& pattern)) {
+          scope -> locals.emplace_back ((* p) -> name , slot);
+        }
+        else if (boost::get <ref <void_value_t>> (& pattern)) {
+          emit (opcode::match_void , slot);
+        }
+        else if (auto p = boost::get <ref <int_value_t>> (& pattern)) {
+          emit (opcode::match_int , slot , (* p) -> data);
+        }
+        // 長さを確かめてから, 要素を 1 つずつ新しいスロットに取り出して照合する
+        else if (auto p = boost::get <ref <tuple_t>> (& pattern)) {
+          auto & es = (* p) -> elements;
+          emit (opcode::match_tuple , slot , static_cast <std::int64_t> (es.size ()));
+          for (std::size_t i = 0; i < es.size (); ++ i) {
+            auto element = scope -> new_local ();
+            emit (opcode::load_element , slot , static_cast <std::int64_t> (i));
+            emit (opcode::store_local , element);
+            compile_pattern (es [i] , element);
+          }
+        }
+        else {
+          throw std::runtime_error {"failed pattern match. pattern is not a constructor."};
+        }
+      }
+
+      // 関数本体を別のバッファにコンパイルして, 出来上がったら code の末尾に置く
+      template <typename F>
+      auto compile_function (std::uint32_t index , scope_t & inner , F && f) {
+        std::vector <instruction> buffer;
+        auto outer_scope = scope;
+        auto outer_body = body;
+        scope = & inner;
+        body = & buffer;
+        f ();
+        scope = outer_scope;
+        body = outer_body;
+        // 飛び先はバッファの中の位置なので, 置く場所に合わせてずらす
+        auto entry = static_cast <std::uint32_t> (out.code.size ());
+        for (auto && ins : buffer) {
+          if (ins.op == opcode::jump || ins.op == opcode::jump_if_zero) {
+            ins.a += entry;
+          }
+          else if (ins.op == opcode::dispatch) {
+            out.tables [ins.a].map ([&] (std::uint32_t t) {
+              return t + entry;
+            });
+          }
+        }
+        out.functions [index] = function_t {
+          entry ,
+          inner.local_count ,
+          static_cast <std::uint32_t> (out.captures.size ()) ,
+          static_cast <std::uint32_t> (inner.captures.size ())
+        };
+        out.code.insert (out.code.end () , buffer.begin () , buffer.end ());
+        for (auto && c : inner.captures) {
+          out.captures.push_back (c.second);
+        }
+      }
+
+      auto operator () (const ref <void_value_t> &) -> void {
+        emit (opcode::push_void);
+      }
+
+      auto operator () (const ref <int_value_t> & p) -> void {
+        emit (opcode::push_int , 0 , p -> data);
+      }
+
+      auto operator () (const ref <var_t> & p) -> void {
+        auto r = scope -> resolve (p -> name);
+        if (! r.first) {
+          emit (opcode::undefined , name_index (p -> name));
+        }
+        else if (r.second.local) {
+          emit (opcode::load_local , r.second.index);
+        }
+        else {
+          emit (opcode::load_captured , r.second.index);
+        }
+      }
+
+      auto operator () (const ref <lambda_t> & p) -> void {
+        emit (opcode::make_closure , compile_lambda (p));
+      }
+
+      // LetRec は f のスロットを先に用意して, ラムダの中からはそのスロットを捕獲させる
+      auto operator () (const ref <letrec_t> & p) -> void {
+        auto slot = scope -> new_local ();
+        auto mark = scope -> locals.size ();
+        scope -> locals.emplace_back (p -> name , slot);
+        emit (opcode::make_rec_closure , compile_lambda (p -> func) , slot);
+        emit (opcode::store_local , slot);
+        compile (p -> body);
+        scope -> locals.resize (mark);
+      }
+
+      // 関数を code に置いて, その番号を返す
+      auto compile_lambda (const ref <lambda_t> & p) -> std::uint32_t {
+        auto index = static_cast <std::uint32_t> (out.functions.size ());
+        out.functions.push_back (function_t {});
+        scope_t inner {scope , index};
+        compile_function (index , inner , [&] {
+          compile_pattern (p -> arg , inner.new_local ());
+          compile (p -> body);
+          emit (opcode::ret);
+          // jump を辿った先がすぐ ret になる call は末尾呼び出しにする
+          for (auto && ins : * body) {
+            if (ins.op != opcode::call) {
+              continue;
+            }
+            auto i = static_cast <std::size_t> (& ins - body -> data ()) + 1;
+            while ((* body) [i].op == opcode::jump) {
+              i = (* body) [i].a;
+            }
+            if ((* body) [i].op == opcode::ret) {
+              ins.op = opcode::tail_call;
+            }
+          }
+        });
+        return index;
+      }
+
+      auto operator () (const ref <prim_t> & p) -> void {
+        compile (p -> lhs);
+        compile (p -> rhs);
+        emit (opcode::primitive , static_cast <std::uint32_t> (p -> op));
+      }
+
+      auto operator () (const ref <if_t> & p) -> void {
+        compile (p -> test);
+        auto to_alternative = body -> size ();
+        emit (opcode::jump_if_zero);
+        compile (p -> consequent);
+        auto to_end = body -> size ();
+        emit (opcode::jump);
+        (* body) [to_alternative].a = static_cast <std::uint32_t> (body -> size ());
+        compile (p -> alternative);
+        (* body) [to_end].a = static_cast <std::uint32_t> (body -> size ());
+      }
+
+      // 照合する値をスロットに置いて表で節に飛ぶ. 節の終わりからは全部の節の後ろに飛ぶ
+      auto operator () (const ref <match_t> & p) -> void {
+        compile (p -> scrutinee);
+        auto slot = scope -> new_local ();
+        emit (opcode::store_local , slot);
+        auto index = static_cast <std::uint32_t> (out.tables.size ());
+        out.tables.push_back (p -> table);
+        emit (opcode::dispatch , index , slot);
+        std::vector <std::uint32_t> labels;
+        std::vector <std::size_t> ends;
+        for (std::uint32_t i = 0; i < p -> clauses.size (); ++ i) {
+          labels.push_back (static_cast <std::uint32_t> (body -> size ()));
+          auto mark = scope -> locals.size ();
+          if (auto x = p -> binder (i)) {
+            scope -> locals.emplace_back (x -> name , slot);
+          }
+          compile (p -> clauses [i].body);
+          scope -> locals.resize (mark);
+          ends.push_back (body -> size ());
+          emit (opcode::jump);
+        }
+        for (auto e : ends) {
+          (* body) [e].a = static_cast <std::uint32_t> (body -> size ());
+        }
+        out.tables [index].map ([&] (std::uint32_t i) {
+          return labels [i];
+        });
+      }
+
+      auto operator () (const ref <tuple_t> & p) -> void {
+        for (auto && e : p -> elements) {
+          compile (e);
+        }
+        emit (opcode::make_tuple , static_cast <std::uint32_t> (p -> elements.size ()));
+      }
+
+      // Apply (Lambda (a , b) , e) (つまり Let) はクロージャを作らずに今のフレームのスロットに束縛する
+      auto operator () (const ref <apply_t> & p) -> void {
+        if (auto l = boost::get <ref <lambda_t>> (& p -> func)) {
+          compile (p -> expr);
+          auto slot = scope -> new_local ();
+          emit (opcode::store_local , slot);
+          auto mark = scope -> locals.size ();
+          compile_pattern ((* l) -> arg , slot);
+          compile ((* l) -> body);
+          scope -> locals.resize (mark);
+          return;
+        }
+        compile (p -> func);
+        // eval と同じく, 引数を評価する前に関数であることを確かめる
+        emit (opcode::check_function);
+        compile (p -> expr);
+        emit (opcode::call);
+      }
+    };
+  }
+
+  inline auto compile (const expression & e) -> code_t {
+    code_t out;
+    out.functions.push_back (function_t {});
+    detail::scope_t top {nullptr , 0};
+    detail::compiler c {out , & top , nullptr};
+    c.compile_function (0 , top , [&] {
+      c.compile (e);
+      c.emit (opcode::halt);
+    });
+    return out;
+  }
+
+  // parameter を自由変数として含む e をコンパイルする. parameter はトップレベルの locals [0] になり,
+  // 値は run (code , argument) で渡す. 出来たコードは書き換えられないので, いくつのスレッドから同時に run してもよい
+  inline auto compile (const expression & e , symbol parameter) -> code_t {
+    code_t out;
+    out.functions.push_back (function_t {});
+    detail::scope_t top {nullptr , 0};
+    top.locals.emplace_back (parameter , top.new_local ());
+    detail::compiler c {out , & top , nullptr};
+    c.compile_function (0 , top , [&] {
+      c.compile (e);
+      c.emit (opcode::halt);
+    });
+    return out;
+  }
+
+
+  struct call_frame_t {
+    std::uint32_t return_pc;
+    std::size_t fp;
+    ref <closure_t> closure;
+  };
+
+  namespace detail {
+    // execute から見た code_t. 配列は先頭のポインタで引く
+    struct code_access {
+      const instruction * code;
+      const function_t * functions;
+      const capture_t * captures;
+      const code_t & source;
+
+      auto select (std::uint32_t table , const value_t & v) const {
+        return source.tables [table].select (v);
+      }
+
+      auto name (std::uint32_t i) const -> const std::string & {
+        return source.names [i];
+      }
+    };
+
+    // Program は code , functions , captures を添字で引け, select (表 , 値) と name (番号) を持つもの
+    template <typename Program>
+    inline auto execute (const Program & code , const value_t & argument) -> value_t {
+      std::vector <value_t> stack;
+      std::vector <call_frame_t> frames;
+      auto & top = code.functions [0];
+      std::size_t fp = 0;
+      stack.resize (top.locals);
+      if (! stack.empty ()) {
+        stack [0] = argument;
+      }
+      ref <closure_t> closure;
+      auto pc = top.entry;
+      for (;;) {
+        auto & ins = code.code [pc ++];
+        switch (ins.op) {
+          case opcode::push_void:
+            stack.emplace_back ();
+            break;
+          case opcode::push_int:
+            stack.push_back (value_t::integer (ins.b));
+            break;
+          case opcode::load_local:
+            stack.push_back (stack [fp + ins.a]);
+            break;
+          case opcode::load_captured:
+            stack.push_back (closure -> captured [ins.a]);
+            break;
+          case opcode::store_local:
+            stack [fp + ins.a] = std::move (stack.back ());
+            stack.pop_back ();
+            break;
+          case opcode::match_void:
+            if (! stack [fp + ins.a].is_void ()) {
+              throw std::runtime_error {"failed pattern match."};
+            }
+            break;
+          case opcode::match_int:
+            if (! stack [fp + ins.a].is_int () || stack [fp + ins.a].as_int () != ins.b) {
+              throw std::runtime_error {"failed pattern match."};
+            }
+            break;
+          case opcode::make_closure: {
+            auto & f = code.functions [ins.a];
+            std::vector <value_t> captured;
+            captured.reserve (f.capture_count);
+            for (auto i = f.capture_begin; i < f.capture_begin + f.capture_count; ++ i) {
+              auto & c = code.captures [i];
+              captured.push_back (c.local ? stack [fp + c.index] : closure -> captured [c.index]);
+            }
+            stack.emplace_back (make <closure_t> (ins.a , std::move (captured)));
+            break;
+          }
+          case opcode::make_rec_closure: {
+            auto & f = code.functions [ins.a];
+            auto self = make <closure_t> (ins.a , std::vector <value_t> (f.capture_count));
+            for (std::uint32_t i = 0; i < f.capture_count; ++ i) {
+              auto & c = code.captures [f.capture_begin + i];
+              if (c.local && c.index == ins.b) {
+                self -> captured [i] = value_t {self};
+              }
+              else {
+                self -> captured [i] = c.local ? stack [fp + c.index] : closure -> captured [c.index];
+              }
+            }
+            stack.emplace_back (std::move (self));
+            break;
+          }
+          case opcode::call: {
+            auto & callee = stack [stack.size () - 2];
+            // compile は check_function を先に置くが, 版 1 と 2 の像には無い
+            if (! callee.is (object_kind::vm_closure)) {
+              throw std::runtime_error {"the object <which is not a function> cannot apply."};
+            }
+            frames.push_back (call_frame_t {pc , fp , std::move (closure)});
+            closure = ref <closure_t> {callee.get <closure_t> ()};
+            auto & f = code.functions [closure -> function];
+            // 引数が locals [0] になるように, 関数の居た場所を詰める
+            callee = std::move (stack.back ());
+            stack.pop_back ();
+            fp = stack.size () - 1;
+            stack.resize (fp + f.locals);
+            pc = f.entry;
+            break;
+          }
+          case opcode::tail_call: {
+            auto & callee = stack [stack.size () - 2];
+            if (! callee.is (object_kind::vm_closure)) {
+              throw std::runtime_error {"the object <which is not a function> cannot apply."};
+            }
+            closure = ref <closure_t> {callee.get <closure_t> ()};
+            auto & f = code.functions [closure -> function];
+            auto arg = std::move (stack.back ());
+            stack.resize (fp);
+            stack.push_back (std::move (arg));
+            stack.resize (fp + f.locals);
+            pc = f.entry;
+            break;
+          }
+          case opcode::ret: {
+            auto result = std::move (stack.back ());
+            stack.resize (fp);
+            stack.push_back (std::move (result));
+            auto & frame = frames.back ();
+            pc = frame.return_pc;
+            fp = frame.fp;
+            closure = std::move (frame.closure);
+            frames.pop_back ();
+            break;
+          }
+          case opcode::primitive: {
+            auto & x = stack [stack.size () - 2];
+            auto r = compute (static_cast <pro::primitive> (ins.a) , x , stack.back ());
+            if (! r) {
+              throw std::runtime_error {message (r.error)};
+            }
+            x = std::move (r.value);
+            stack.pop_back ();
+            break;
+          }
+          case opcode::jump:
+            pc = ins.a;
+            break;
+          case opcode::jump_if_zero: {
+            auto & x = stack.back ();
+            if (! x.is_int ()) {
+              throw std::runtime_error {message (failure::not_an_integer)};
+            }
+            if (x.as_int () == 0) {
+              pc = ins.a;
+            }
+            stack.pop_back ();
+            break;
+          }
+          case opcode::dispatch: {
+            auto target = code.select (ins.a , stack [fp + ins.b]);
+            if (target == case_table_t::none) {
+              throw std::runtime_error {"failed pattern match."};
+            }
+            pc = target;
+            break;
+          }
+          case opcode::undefined: {
+            std::stringstream ss;
+            ss << code.name (ins.a) << " is undefined.";
+            throw std::runtime_error {ss.str ()};
+          }
+          case opcode::halt:
+            return std::move (stack.back ());
+          case opcode::check_function:
+            if (! stack.back ().is (object_kind::vm_closure)) {
+              throw std::runtime_error {"the object <which is not a function> cannot apply."};
+            }
+            break;
+          case opcode::make_tuple: {
+            auto first = stack.end () - ins.a;
+            auto v = make_vector (std::vector <value_t> (std::make_move_iterator (first) , std::make_move_iterator (stack.end ())));
+            stack.erase (first , stack.end ());
+            stack.emplace_back (std::move (v));
+            break;
+          }
+          case opcode::match_tuple: {
+            const value_t & x = stack [fp + ins.a];
+            if (! x.is (object_kind::vector) || x.get <vector_t> () -> size () != static_cast <std::uint64_t> (ins.b)) {
+              throw std::runtime_error {"failed pattern match."};
+            }
+            break;
+          }
+          // 普通は match_tuple の後なので失敗しない. 像から読んだコードでも範囲の外を読まないように確かめる
+          case opcode::load_element: {
+            const value_t & x = stack [fp + ins.a];
+            if (! x.is (object_kind::vector) || static_cast <std::uint64_t> (ins.b) >= x.get <vector_t> () -> size ()) {
+              throw std::runtime_error {"failed pattern match."};
+            }
+            stack.push_back ((* x.get <vector_t> ()) [static_cast <std::size_t> (ins.b)]);
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  inline auto run (const code_t & code , const value_t & argument = value_t {}) -> value_t {
+    return detail::execute (detail::code_access {code.code.data () , code.functions.data () , code.captures.data () , code} , argument);
+  }
+}}
+
+#endif // PRO_VM_HPP
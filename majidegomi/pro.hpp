@@ -0,0 +1,2679 @@
+#ifndef PRO_HPP
+#define PRO_HPP
+#include <utility>
+#include <type_traits>
+#include <sstream>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <unordered_map>
+#include <stdexcept>
+#include <iterator>
+#ifdef PRO_PROFILE
+#include <chrono>
+#endif
+#include <boost/variant.hpp>
+#include "../include/operator.hpp"
+
+namespace pro {
+  // 構文木のノードと実行時の値が指すヒープのオブジェクト. 参照カウントはオブジェクト自身が持つ.
+  enum class object_kind : std::uint8_t {
+    syntax ,
+    frame ,
+    integer ,
+    closure ,
+    thunk ,
+    vm_closure ,
+    vector ,
+    vector_node ,
+  };
+
+  // 参照カウントは既定ではただの整数で, オブジェクトは作ったスレッドのもの (他のスレッドに渡すのはデータだけ).
+  // 評価器のインスタンスをスレッドをまたいで共有するときは PRO_ATOMIC_REFCOUNT を定義して atomic にする.
+  namespace detail {
+#ifdef PRO_ATOMIC_REFCOUNT
+    using refcount_t = std::atomic <std::uint32_t>;
+#else
+    using refcount_t = std::uint32_t;
+#endif
+  }
+
+  struct object_t;
+
+  namespace detail {
+    // 他の実行時オブジェクトを指せる種類だけを循環の回収のために登録する
+    constexpr auto traced (object_kind k) noexcept {
+      return k == object_kind::frame || k == object_kind::closure || k == object_kind::thunk || k == object_kind::vm_closure
+        || k == object_kind::vector || k == object_kind::vector_node;
+    }
+
+    inline auto track (object_t * p) -> void;
+    inline auto untrack (object_t * p) noexcept -> void;
+
+#ifdef PRO_ATOMIC_REFCOUNT
+    struct shard_t;
+#endif
+
+#ifdef PRO_PROFILE
+    inline auto profile_allocation (object_kind k , std::size_t bytes) noexcept -> void;
+#endif
+  }
+
+  struct object_t {
+    mutable detail::refcount_t refs;
+    object_kind kind;
+    // traced な種類なら登録表の中の位置
+    std::uint32_t index;
+#ifdef PRO_ATOMIC_REFCOUNT
+    // 登録した表. 別のスレッドで消えても同じ表から外す
+    detail::shard_t * shard;
+#endif
+
+    explicit object_t (object_kind k)
+      : refs {0}
+      , kind {k}
+      , index {0}
+#ifdef PRO_ATOMIC_REFCOUNT
+      , shard {nullptr}
+#endif
+      {
+      if (detail::traced (kind)) {
+        detail::track (this);
+      }
+    }
+
+    object_t (const object_t &) = delete;
+    auto operator = (const object_t &) -> object_t & = delete;
+
+    virtual ~ object_t () {
+      if (detail::traced (kind)) {
+        detail::untrack (this);
+      }
+    }
+
+    // 参照している実行時オブジェクトを out に積む
+    virtual auto children (std::vector <object_t *> &) const -> void {}
+
+    // 循環を壊すために参照を全部手放す. 回収のときだけ呼ばれる
+    virtual auto clear () -> void {}
+  };
+
+  namespace detail {
+    // 解放の途中で 0 になったオブジェクトはここに積んで, 一番外側の解放が順に消す.
+    // 長いフレームの列やクロージャの鎖, 深い構文木を消しても再帰が深くならない
+    struct trash_t {
+      std::vector <const object_t *> pending;
+      bool active;
+    };
+
+    template <typename = void>
+    struct trash_holder {
+      static thread_local trash_t t;
+    };
+
+    template <typename T>
+    thread_local trash_t trash_holder <T>::t {};
+
+    inline auto destroy (const object_t * p) noexcept {
+      auto & t = trash_holder <>::t;
+      if (t.active) {
+        t.pending.push_back (p);
+        return;
+      }
+      t.active = true;
+      delete p;
+      while (! t.pending.empty ()) {
+        auto q = t.pending.back ();
+        t.pending.pop_back ();
+        delete q;
+      }
+      t.active = false;
+    }
+  }
+
+#ifdef PRO_ATOMIC_REFCOUNT
+  inline auto retain (const object_t * p) noexcept {
+    p -> refs.fetch_add (1 , std::memory_order_relaxed);
+  }
+
+  inline auto release (const object_t * p) noexcept {
+    if (p -> refs.fetch_sub (1 , std::memory_order_acq_rel) == 1) {
+      detail::destroy (p);
+    }
+  }
+#else
+  inline auto retain (const object_t * p) noexcept {
+    ++ p -> refs;
+  }
+
+  inline auto release (const object_t * p) noexcept {
+    if (-- p -> refs == 0) {
+      detail::destroy (p);
+    }
+  }
+#endif
+
+  // object_t を継承した型への侵入型の参照
+  template <typename T>
+  class ref {
+    T * p;
+
+  public:
+    ref () noexcept
+      : p {nullptr} {}
+
+    explicit ref (T * q) noexcept
+      : p {q} {
+      if (p) {
+        retain (p);
+      }
+    }
+
+    ref (const ref & other) noexcept
+      : ref {other.p} {}
+
+    ref (ref && other) noexcept
+      : p {other.p} {
+      other.p = nullptr;
+    }
+
+    auto operator = (ref other) noexcept -> ref & {
+      std::swap (p , other.p);
+      return * this;
+    }
+
+    ~ ref () {
+      if (p) {
+        release (p);
+      }
+    }
+
+    auto get () const noexcept {
+      return p;
+    }
+
+    auto operator -> () const noexcept {
+      return p;
+    }
+
+    auto operator * () const noexcept -> T & {
+      return * p;
+    }
+
+    auto use_count () const noexcept -> std::uint32_t {
+      return p ? static_cast <std::uint32_t> (p -> refs) : 0;
+    }
+
+    explicit operator bool () const noexcept {
+      return p != nullptr;
+    }
+  };
+
+  template <typename T , typename ... Args>
+  auto make (Args && ... args) {
+#ifdef PRO_PROFILE
+    auto p = new T (std::forward <Args> (args) ...);
+    detail::profile_allocation (p -> kind , sizeof (T));
+    return ref <T> {p};
+#else
+    return ref <T> {new T (std::forward <Args> (args) ...)};
+#endif
+  }
+
+  // 循環した実行時オブジェクトを回収する.
+  // 参照カウントの大半は評価器 (eval のローカル変数, machine のレジスタと継続, VM のスタック) が持つものなので,
+  // 登録した全オブジェクトのカウントから登録表の内側どうしの参照を差し引き, 残ったものを根とする.
+  // 根から辿れないものはまとめて参照を手放させて解放する. 循環しないゴミは参照カウントがすぐに解放する.
+  namespace detail {
+    constexpr std::size_t initial_threshold = 4096;
+
+    // objects のうち根から辿れないもの. at (p) は p の objects の中での位置
+    template <typename F>
+    inline auto find_garbage (const std::vector <object_t *> & objects , F at) -> std::vector <object_t *> {
+      auto n = objects.size ();
+      std::vector <std::int64_t> counts (n);
+      std::vector <object_t *> children;
+      for (std::size_t i = 0; i < n; ++ i) {
+        counts [i] = objects [i] -> refs;
+      }
+      for (auto p : objects) {
+        children.clear ();
+        p -> children (children);
+        for (auto c : children) {
+          if (traced (c -> kind)) {
+            -- counts [at (c)];
+          }
+        }
+      }
+      // 外から参照されているものに印をつけて, そこから辿れるものにも印をつける. 印は -1
+      std::vector <object_t *> work;
+      for (std::size_t i = 0; i < n; ++ i) {
+        if (counts [i] > 0) {
+          counts [i] = -1;
+          work.push_back (objects [i]);
+        }
+      }
+      while (! work.empty ()) {
+        auto p = work.back ();
+        work.pop_back ();
+        children.clear ();
+        p -> children (children);
+        for (auto c : children) {
+          if (traced (c -> kind) && counts [at (c)] != -1) {
+            counts [at (c)] = -1;
+            work.push_back (c);
+          }
+        }
+      }
+      std::vector <object_t *> garbage;
+      for (std::size_t i = 0; i < n; ++ i) {
+        if (counts [i] != -1) {
+          garbage.push_back (objects [i]);
+        }
+      }
+      return garbage;
+    }
+
+    // 全部を握ってから参照を手放させるので, 途中で解放されるものはない. 最後に握ったのを離すと消える
+    inline auto free_garbage (const std::vector <object_t *> & garbage) -> void {
+      for (auto p : garbage) {
+        retain (p);
+      }
+      for (auto p : garbage) {
+        p -> clear ();
+      }
+      for (auto p : garbage) {
+        release (p);
+      }
+    }
+
+#ifdef PRO_ATOMIC_REFCOUNT
+    // スレッドごとの登録表. 登録も削除もほとんど持ち主のスレッドだけなので, mutex はまず取り合いにならない.
+    // 持ち主が終わっても中のオブジェクトは生きているかもしれないので, 表は消さずに次のスレッドに渡す
+    struct shard_t {
+      std::mutex mutex;
+      std::vector <object_t *> objects;
+      // 回収のときに全部の表をつないだ中での先頭の位置
+      std::size_t base;
+      // 使っているスレッドがあるか. heap_t::mutex で守る
+      bool owned;
+
+      shard_t ()
+        : mutex {}
+        , objects {}
+        , base {0}
+        , owned {true} {}
+    };
+
+    // 評価の最中だと参照カウントも子も変わり続けるので, 回収は評価しているスレッドが 1 つも無いときだけ行う.
+    // 評価するスレッドは session_t を持ち, 最後の session_t が抜けるところで閾値を超えていたら回収する
+    constexpr auto collecting_sessions = ~ std::uint32_t {0};
+
+    struct heap_t {
+      // shards の出し入れを守る
+      std::mutex mutex;
+      std::vector <shard_t *> shards;
+      std::size_t threshold;
+      // 評価中の session_t の数. 回収している間は collecting_sessions
+      std::atomic <std::uint32_t> sessions;
+
+      heap_t ()
+        : mutex {}
+        , shards {}
+        , threshold {initial_threshold}
+        , sessions {0} {}
+
+      auto acquire () -> shard_t * {
+        std::lock_guard <std::mutex> lock {mutex};
+        for (auto s : shards) {
+          if (! s -> owned) {
+            s -> owned = true;
+            return s;
+          }
+        }
+        shards.push_back (new shard_t);
+        return shards.back ();
+      }
+
+      auto abandon (shard_t * s) -> void {
+        std::lock_guard <std::mutex> lock {mutex};
+        s -> owned = false;
+      }
+
+      auto size () -> std::size_t {
+        std::lock_guard <std::mutex> lock {mutex};
+        std::size_t n = 0;
+        for (auto s : shards) {
+          std::lock_guard <std::mutex> l {s -> mutex};
+          n += s -> objects.size ();
+        }
+        return n;
+      }
+
+      // 全部の表をつないで数える. 手放させるのは表の mutex を離してから (解放が untrack で表に触るので)
+      auto collect () -> std::size_t {
+        std::vector <object_t *> garbage;
+        std::size_t total;
+        {
+          std::lock_guard <std::mutex> lock {mutex};
+          std::vector <std::unique_lock <std::mutex>> locks;
+          std::vector <object_t *> objects;
+          for (auto s : shards) {
+            locks.emplace_back (s -> mutex);
+            s -> base = objects.size ();
+            objects.insert (objects.end () , s -> objects.begin () , s -> objects.end ());
+          }
+          garbage = find_garbage (objects , [] (const object_t * p) {
+            return p -> shard -> base + p -> index;
+          });
+          total = objects.size ();
+        }
+        free_garbage (garbage);
+        threshold = std::max (initial_threshold , (total - garbage.size ()) * 2);
+        return garbage.size ();
+      }
+
+      // 評価しているスレッドが無くなるまで待って, 新しく評価を始めさせないようにする
+      auto close () -> void {
+        for (;;) {
+          std::uint32_t idle = 0;
+          if (sessions.compare_exchange_weak (idle , collecting_sessions , std::memory_order_acquire)) {
+            return;
+          }
+          std::this_thread::yield ();
+        }
+      }
+
+      auto open () -> void {
+        sessions.store (0 , std::memory_order_release);
+      }
+
+      auto enter () -> void {
+        auto n = sessions.load (std::memory_order_relaxed);
+        for (;;) {
+          if (n == collecting_sessions) {
+            std::this_thread::yield ();
+            n = sessions.load (std::memory_order_relaxed);
+          }
+          else if (sessions.compare_exchange_weak (n , n + 1 , std::memory_order_acquire)) {
+            return;
+          }
+        }
+      }
+
+      // 最後に抜けたスレッドが, まだ誰も入ってこなければ回収する
+      auto leave () -> void {
+        if (sessions.fetch_sub (1 , std::memory_order_acq_rel) != 1) {
+          return;
+        }
+        std::uint32_t idle = 0;
+        if (! sessions.compare_exchange_strong (idle , collecting_sessions , std::memory_order_acquire)) {
+          return;
+        }
+        if (size () >= threshold) {
+          collect ();
+        }
+        open ();
+      }
+    };
+
+    // shards に載せた表は消さないので, heap_t もプログラムの終わりまで消さない
+    template <typename = void>
+    struct heap_holder {
+      static heap_t & h;
+    };
+
+    template <typename T>
+    heap_t & heap_holder <T>::h = * new heap_t;
+
+    inline auto heap () -> heap_t & {
+      return heap_holder <>::h;
+    }
+
+    // スレッドが終わるときに表を手放す
+    struct shard_owner {
+      shard_t * shard;
+
+      ~ shard_owner () {
+        if (shard) {
+          heap ().abandon (shard);
+        }
+      }
+    };
+
+    template <typename = void>
+    struct shard_holder {
+      static thread_local shard_owner s;
+    };
+
+    template <typename T>
+    thread_local shard_owner shard_holder <T>::s {nullptr};
+
+    inline auto track (object_t * p) -> void {
+      auto & o = shard_holder <>::s;
+      if (! o.shard) {
+        o.shard = heap ().acquire ();
+      }
+      auto s = o.shard;
+      std::lock_guard <std::mutex> lock {s -> mutex};
+      p -> shard = s;
+      p -> index = static_cast <std::uint32_t> (s -> objects.size ());
+      s -> objects.push_back (p);
+    }
+
+    inline auto untrack (object_t * p) noexcept -> void {
+      auto s = p -> shard;
+      std::lock_guard <std::mutex> lock {s -> mutex};
+      auto last = s -> objects.back ();
+      s -> objects [p -> index] = last;
+      last -> index = p -> index;
+      s -> objects.pop_back ();
+    }
+#else
+    struct heap_t {
+      std::vector <object_t *> objects;
+      std::size_t threshold;
+      bool collecting;
+
+      heap_t ()
+        : objects {}
+        , threshold {initial_threshold}
+        , collecting {false} {}
+
+      auto collect () -> std::size_t {
+        collecting = true;
+        auto garbage = find_garbage (objects , [] (const object_t * p) {
+          return p -> index;
+        });
+        free_garbage (garbage);
+        threshold = std::max (initial_threshold , objects.size () * 2);
+        collecting = false;
+        return garbage.size ();
+      }
+    };
+
+    // 関数内の static だと呼ぶたびに初期化済みかを確かめるので, テンプレートの静的メンバにしてヘッダに置く.
+    // 既定ではオブジェクトは作ったスレッドのものなので登録表もスレッドごと
+    template <typename = void>
+    struct heap_holder {
+      static thread_local heap_t h;
+    };
+
+    template <typename T>
+    thread_local heap_t heap_holder <T>::h;
+
+    inline auto heap () -> heap_t & {
+      return heap_holder <>::h;
+    }
+
+    // 登録が閾値を超えたら, 新しいオブジェクトを登録する前に回収する
+    inline auto track (object_t * p) -> void {
+      auto & h = heap ();
+      if (h.objects.size () >= h.threshold && ! h.collecting) {
+        h.collect ();
+      }
+      p -> index = static_cast <std::uint32_t> (h.objects.size ());
+      h.objects.push_back (p);
+    }
+
+    inline auto untrack (object_t * p) noexcept -> void {
+      auto & h = heap ();
+      auto last = h.objects.back ();
+      h.objects [p -> index] = last;
+      last -> index = p -> index;
+      h.objects.pop_back ();
+    }
+#endif
+  }
+
+  // 評価している間持っておく. 既定ではオブジェクトはスレッドごとなので何もしない.
+  // atomic 版では, 実行時のオブジェクトに触るスレッドは触っている間これを持つこと (parallel_eval と pool は自分で持つ).
+  // 最後の session_t が抜けるときに, 登録が閾値を超えていたら回収する
+  struct session_t {
+#ifdef PRO_ATOMIC_REFCOUNT
+    session_t () {
+      detail::heap ().enter ();
+    }
+
+    ~ session_t () {
+      detail::heap ().leave ();
+    }
+#else
+    session_t () {}
+#endif
+
+    session_t (const session_t &) = delete;
+    auto operator = (const session_t &) -> session_t & = delete;
+  };
+
+  // 根から辿れない循環を回収して, 解放したオブジェクトの数を返す.
+  // atomic 版では評価中の session_t が全部抜けるまで待つので, session_t を持ったまま呼ばないこと
+  inline auto collect () -> std::size_t {
+#ifdef PRO_ATOMIC_REFCOUNT
+    auto & h = detail::heap ();
+    h.close ();
+    auto n = h.collect ();
+    h.open ();
+    return n;
+#else
+    return detail::heap ().collect ();
+#endif
+  }
+
+  inline auto traced_objects () -> std::size_t {
+#ifdef PRO_ATOMIC_REFCOUNT
+    return detail::heap ().size ();
+#else
+    return detail::heap ().objects.size ();
+#endif
+  }
+
+  struct void_value_t;
+  struct int_value_t;
+  struct var_t;
+  struct lambda_t;
+  struct apply_t;
+  struct letrec_t;
+  struct prim_t;
+  struct if_t;
+  struct match_t;
+  struct tuple_t;
+
+  using expression = boost::variant <
+    ref <void_value_t>
+  , ref <int_value_t>
+  , ref <var_t>
+  , ref <lambda_t>
+  , ref <apply_t>
+  , ref <letrec_t>
+  , ref <prim_t>
+  , ref <if_t>
+  , ref <match_t>
+  , ref <tuple_t>
+  >;
+
+  // 変数名はシンボル表で小さな整数に置き換える. 文字列に戻すのは表示するときだけ.
+  struct symbol {
+    std::uint32_t id;
+  };
+
+  inline auto operator == (symbol a , symbol b) noexcept {
+    return a.id == b.id;
+  }
+
+  inline auto operator != (symbol a , symbol b) noexcept {
+    return a.id != b.id;
+  }
+
+  namespace detail {
+    struct symbol_table_t {
+      std::mutex mutex;
+      std::deque <std::string> names;
+      std::unordered_map <std::string , std::uint32_t> ids;
+    };
+
+    inline auto symbol_table () -> symbol_table_t & {
+      static symbol_table_t table;
+      return table;
+    }
+  }
+
+  inline auto intern (const std::string & s) -> symbol {
+    auto & table = detail::symbol_table ();
+    std::lock_guard <std::mutex> lock {table.mutex};
+    auto ite = table.ids.find (s);
+    if (ite != table.ids.end ()) {
+      return symbol {ite -> second};
+    }
+    auto id = static_cast <std::uint32_t> (table.names.size ());
+    table.names.push_back (s);
+    table.ids.emplace (s , id);
+    return symbol {id};
+  }
+
+  // deque の要素は動かないので, 返した参照はずっと有効
+  inline auto name_of (symbol s) -> const std::string & {
+    auto & table = detail::symbol_table ();
+    std::lock_guard <std::mutex> lock {table.mutex};
+    return table.names [s.id];
+  }
+
+  struct boxed_int_t : object_t {
+    std::int64_t data;
+
+    explicit boxed_int_t (std::int64_t d) noexcept
+      : object_t {object_kind::integer}
+      , data {d} {}
+  };
+
+  // 実行時の値. 1 ワードに詰めて, 下位ビットで種類を見分ける.
+  //   ...1    63 ビットに収まる整数 (即値)
+  //   ...010  ()
+  //   ...000  object_t へのポインタ (0 は未定義)
+  // 整数と () は確保もカウントもしない. 63 ビットに収まらない整数だけ boxed_int_t に入れる.
+  class value_t {
+    static constexpr std::uintptr_t void_word = 2;
+
+    std::uintptr_t w;
+
+    value_t (std::uintptr_t x , int) noexcept
+      : w {x} {}
+
+  public:
+    value_t () noexcept
+      : w {void_word} {}
+
+    template <typename T>
+    value_t (const ref <T> & r) noexcept
+      : value_t {reinterpret_cast <std::uintptr_t> (static_cast <object_t *> (r.get ())) , 0} {
+      retain (r.get ());
+    }
+
+    value_t (const value_t & other) noexcept
+      : w {other.w} {
+      if (is_object ()) {
+        retain (object ());
+      }
+    }
+
+    value_t (value_t && other) noexcept
+      : w {other.w} {
+      other.w = void_word;
+    }
+
+    auto operator = (const value_t & other) noexcept -> value_t & {
+      value_t tmp {other};
+      std::swap (w , tmp.w);
+      return * this;
+    }
+
+    // 古い値は other が解放する
+    auto operator = (value_t && other) noexcept -> value_t & {
+      std::swap (w , other.w);
+      return * this;
+    }
+
+    ~ value_t () {
+      if (is_object ()) {
+        release (object ());
+      }
+    }
+
+    static auto undefined () noexcept {
+      return value_t {0 , 0};
+    }
+
+    static auto integer (std::int64_t d) -> value_t {
+      constexpr auto limit = std::int64_t {1} << 62;
+      if (-limit <= d && d < limit) {
+        return value_t {(static_cast <std::uintptr_t> (d) << 1) | 1 , 0};
+      }
+      return value_t {make <boxed_int_t> (d)};
+    }
+
+    constexpr auto is_undefined () const noexcept {
+      return w == 0;
+    }
+
+    constexpr auto is_void () const noexcept {
+      return w == void_word;
+    }
+
+    constexpr auto is_object () const noexcept -> bool {
+      return (w & 7) == 0 && w != 0;
+    }
+
+    auto object () const noexcept -> object_t * {
+      return reinterpret_cast <object_t *> (w);
+    }
+
+    auto is (object_kind k) const noexcept {
+      return is_object () && object () -> kind == k;
+    }
+
+    auto is_int () const noexcept {
+      return (w & 1) != 0 || is (object_kind::integer);
+    }
+
+    // 箱に入っていない整数か
+    constexpr auto is_small () const noexcept -> bool {
+      return (w & 1) != 0;
+    }
+
+    // is_small () のときだけ呼ぶ
+    constexpr auto as_small () const noexcept -> std::int64_t {
+      return static_cast <std::int64_t> (w) >> 1;
+    }
+
+    // is_int () のときだけ呼ぶ
+    auto as_int () const noexcept -> std::int64_t {
+      if (w & 1) {
+        return static_cast <std::int64_t> (w) >> 1;
+      }
+      return static_cast <boxed_int_t *> (object ()) -> data;
+    }
+
+    // is (T の種類) のときだけ呼ぶ. 参照は増やさない
+    template <typename T>
+    auto get () const noexcept {
+      return static_cast <T *> (object ());
+    }
+
+    friend auto identical (const value_t & a , const value_t & b) noexcept {
+      return a.w == b.w;
+    }
+  };
+
+  namespace detail {
+    inline auto push_child (const value_t & v , std::vector <object_t *> & out) {
+      if (v.is_object ()) {
+        out.push_back (v.object ());
+      }
+    }
+
+    template <typename T>
+    auto push_child (const ref <T> & r , std::vector <object_t *> & out) {
+      if (r) {
+        out.push_back (const_cast <std::remove_const_t <T> *> (r.get ()));
+      }
+    }
+  }
+
+  // 環境は, 本体を評価中のクロージャが捕獲した値と, その中で束縛したフレームの連結リストからなる.
+  // フレームは共有されるので拡張は O(1).
+  struct frame_t;
+  using frames_t = ref <const frame_t>;
+
+  struct closure_t;
+
+  struct frame_t : object_t {
+    symbol name;
+    value_t value;
+    frames_t next;
+
+    frame_t (symbol n , const value_t & v , const frames_t & nx)
+      : object_t {object_kind::frame}
+      , name {n}
+      , value {v}
+      , next {nx} {}
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      detail::push_child (value , out);
+      detail::push_child (next , out);
+    }
+
+    auto clear () -> void override {
+      value = value_t {};
+      next = frames_t {};
+    }
+  };
+
+  struct environ_t {
+    frames_t frames;
+    ref <closure_t> closure;
+  };
+
+  inline auto extend (const environ_t & env , symbol name , const value_t & v) -> environ_t {
+#ifdef PRO_PROFILE
+    detail::profile_allocation (object_kind::frame , sizeof (frame_t));
+#endif
+    return environ_t {frames_t {new frame_t (name , v , env.frames)} , env.closure};
+  }
+
+  inline auto lookup (const environ_t & env , symbol name) -> const value_t *;
+
+  // サンクなら評価して中身を返す
+  inline auto force (const value_t & v) -> value_t;
+
+  namespace detail {
+    // show_to の書き出し先 (sink) は append (const char * , std::size_t) を持つもの. std::string もそのまま使える
+    template <typename Sink>
+    inline auto put (Sink & sink , const char * s) -> void {
+      sink.append (s , std::char_traits <char>::length (s));
+    }
+
+    template <typename Sink>
+    inline auto put (Sink & sink , const std::string & s) -> void {
+      sink.append (s.data () , s.size ());
+    }
+
+    // iostream を通さずに整数を 10 進で書く. 最小値も符号なしにして扱う
+    template <typename Sink>
+    inline auto put_int (Sink & sink , std::int64_t n) -> void {
+      char buffer [20];
+      auto last = buffer + sizeof buffer;
+      auto p = last;
+      auto u = n < 0 ? 0 - static_cast <std::uint64_t> (n) : static_cast <std::uint64_t> (n);
+      do {
+        * -- p = static_cast <char> ('0' + u % 10);
+        u /= 10;
+      } while (u != 0);
+      if (n < 0) {
+        * -- p = '-';
+      }
+      sink.append (p , static_cast <std::size_t> (last - p));
+    }
+
+    // 出力イテレータを sink にする
+    template <typename OutputIterator>
+    struct iterator_sink {
+      OutputIterator out;
+
+      auto append (const char * s , std::size_t n) -> void {
+        out = std::copy (s , s + n , out);
+      }
+    };
+
+    struct show_f {
+      constexpr show_f () noexcept {}
+
+      template <typename T>
+      auto operator () (const T & p) const -> std::string {
+        return show (p);
+      }
+    };
+
+    struct eval_f {
+      const environ_t & env;
+
+      constexpr eval_f (const environ_t & e)
+        : env {e} {}
+
+      template <typename T>
+      auto operator () (const T & p) const -> value_t {
+        return eval (env , p);
+      }
+    };
+
+    struct pattern_match_f {
+      const value_t & expr;
+      environ_t * env;
+
+      pattern_match_f (const value_t & e , environ_t * env_)
+        : expr {e}
+        , env {env_} {}
+
+      template <typename T>
+      auto operator () (const T & p) const -> bool {
+        return pattern_match (p , expr , * env);
+      }
+    };
+  }
+
+#ifdef PRO_PROFILE
+  // PRO_PROFILE を定義すると, eval と pattern_match を数えて, ラムダの呼び出しの時間を計る. 定義しなければ何も埋め込まない.
+  // 数えるのはスレッドごとで, profile () がいまのスレッドの分を返す.
+  // ラムダはアドレスで見分ける. 計測中に解放したラムダのアドレスが使い回されると混ざる
+  class profile_t {
+  public:
+    using clock_type = std::chrono::steady_clock;
+
+    static constexpr std::size_t node_kinds = 10;
+    static constexpr std::size_t object_kinds = 8;
+
+    // expression の並び順
+    static auto node_name (std::size_t i) noexcept -> const char * {
+      constexpr const char * names [node_kinds] = {"void" , "int" , "var" , "lambda" , "apply" , "letrec" , "prim" , "if" , "match" , "tuple"};
+      return names [i];
+    }
+
+    // object_kind の並び順
+    static auto object_name (std::size_t i) noexcept -> const char * {
+      constexpr const char * names [object_kinds] = {"syntax" , "frame" , "integer" , "closure" , "thunk" , "vm_closure" , "vector" , "vector_node"};
+      return names [i];
+    }
+
+    std::uint64_t evals [node_kinds];
+    std::uint64_t matches [node_kinds];
+    std::uint64_t allocations [object_kinds];
+    std::uint64_t bytes [object_kinds];
+    // クロージャを作ったときの, 捕獲した値の数と環境のフレームの数
+    std::uint64_t closures;
+    std::uint64_t captured_total;
+    std::uint64_t captured_max;
+    std::uint64_t frames_total;
+    std::uint64_t frames_max;
+    std::uint64_t depth;
+    std::uint64_t max_depth;
+
+  private:
+    // 呼び出しの木. calls [0] は根 (ラムダの外). self は子を除いた時間 [ns]
+    struct call_t {
+      const object_t * lambda;
+      std::size_t parent;
+      std::uint64_t count;
+      std::uint64_t self;
+      std::vector <std::size_t> children;
+    };
+
+    struct lambda_info {
+      std::uint32_t id;
+      bool named;
+      const char * prefix;
+      symbol name;
+    };
+
+    std::vector <call_t> calls;
+    std::size_t current;
+    clock_type::time_point last;
+    std::unordered_map <const object_t * , lambda_info> lambdas;
+
+    auto info (const object_t * lambda) -> lambda_info & {
+      auto ite = lambdas.find (lambda);
+      if (ite == lambdas.end ()) {
+        ite = lambdas.emplace (lambda , lambda_info {static_cast <std::uint32_t> (lambdas.size ()) , false , "" , symbol {}}).first;
+      }
+      return ite -> second;
+    }
+
+    // 前の出来事からの時間を今いる呼び出しに足す
+    auto charge () -> void {
+      auto now = clock_type::now ();
+      calls [current].self += static_cast <std::uint64_t> (std::chrono::duration_cast <std::chrono::nanoseconds> (now - last).count ());
+      last = now;
+    }
+
+    // 名前に空白や ; があると collapsed の書式が崩れるので _ にする
+    template <typename Sink>
+    auto put_lambda (Sink & sink , const object_t * lambda) const -> void {
+      if (! lambda) {
+        detail::put (sink , "pro");
+        return;
+      }
+      auto & i = lambdas.at (lambda);
+      if (! i.named) {
+        detail::put (sink , "lambda#");
+        detail::put_int (sink , i.id);
+        return;
+      }
+      auto s = i.prefix + name_of (i.name);
+      for (auto && c : s) {
+        if (c == ' ' || c == ';' || c == '\n' || c == '\t') {
+          c = '_';
+        }
+      }
+      detail::put (sink , s);
+    }
+
+    // 呼び出しの木を行きがけと帰りがけで辿る
+    template <typename Enter , typename Leave>
+    auto walk (Enter && enter , Leave && leave) const -> void {
+      std::vector <std::pair <std::size_t , std::size_t>> stack {{0 , 0}};
+      enter (std::size_t {0});
+      while (! stack.empty ()) {
+        auto & top = stack.back ();
+        auto & c = calls [top.first];
+        if (top.second < c.children.size ()) {
+          auto child = c.children [top.second ++];
+          enter (child);
+          stack.emplace_back (child , 0);
+        }
+        else {
+          leave (top.first);
+          stack.pop_back ();
+        }
+      }
+    }
+
+  public:
+    profile_t () {
+      reset ();
+    }
+
+    auto reset () -> void {
+      std::fill (std::begin (evals) , std::end (evals) , 0);
+      std::fill (std::begin (matches) , std::end (matches) , 0);
+      std::fill (std::begin (allocations) , std::end (allocations) , 0);
+      std::fill (std::begin (bytes) , std::end (bytes) , 0);
+      closures = captured_total = captured_max = frames_total = frames_max = 0;
+      depth = max_depth = 0;
+      calls.assign (1 , call_t {nullptr , 0 , 0 , 0 , {}});
+      current = 0;
+      last = clock_type::now ();
+      lambdas.clear ();
+    }
+
+    auto enter_eval (std::size_t kind) -> void {
+      ++ evals [kind];
+      if (depth ++ == 0) {
+        last = clock_type::now ();
+      }
+      max_depth = std::max (max_depth , depth);
+    }
+
+    auto leave_eval () -> void {
+      if (-- depth == 0) {
+        charge ();
+      }
+    }
+
+    auto match (std::size_t kind) noexcept -> void {
+      ++ matches [kind];
+    }
+
+    auto allocate (object_kind k , std::size_t n) noexcept -> void {
+      ++ allocations [static_cast <std::size_t> (k)];
+      bytes [static_cast <std::size_t> (k)] += n;
+    }
+
+    auto close (std::size_t captured , std::size_t frames) noexcept -> void {
+      ++ closures;
+      captured_total += captured;
+      captured_max = std::max <std::uint64_t> (captured_max , captured);
+      frames_total += frames;
+      frames_max = std::max <std::uint64_t> (frames_max , frames);
+    }
+
+    // ラムダに prefix と n をつなげた名前をつける. 最初につけた名前を使う
+    auto name (const object_t * lambda , symbol n , const char * prefix = "") -> void {
+      auto & i = info (lambda);
+      if (! i.named) {
+        i.named = true;
+        i.prefix = prefix;
+        i.name = n;
+      }
+    }
+
+    auto call (const object_t * lambda) -> void {
+      charge ();
+      info (lambda);
+      auto & children = calls [current].children;
+      auto ite = std::find_if (children.begin () , children.end () , [&] (auto i) {
+        return calls [i].lambda == lambda;
+      });
+      std::size_t next;
+      if (ite != children.end ()) {
+        next = * ite;
+      }
+      else {
+        next = calls.size ();
+        calls [current].children.push_back (next);
+        calls.push_back (call_t {lambda , current , 0 , 0 , {}});
+      }
+      ++ calls [next].count;
+      current = next;
+    }
+
+    auto ret () -> void {
+      charge ();
+      current = calls [current].parent;
+    }
+
+    // 数えたものとラムダごとの呼び出し回数, 自分の時間, 中で呼んだものを含む時間 [us] を自分の時間の順に書く.
+    // 再帰しているラムダの含む時間は, いちばん外の呼び出しだけで数える
+    template <typename Sink>
+    auto report (Sink & sink) const -> void {
+      auto line = [&] (const char * label , std::uint64_t n) {
+        detail::put (sink , label);
+        detail::put_int (sink , static_cast <std::int64_t> (n));
+        detail::put (sink , "\n");
+      };
+      detail::put (sink , "eval\n");
+      for (std::size_t i = 0; i < node_kinds; ++ i) {
+        detail::put (sink , "  ");
+        detail::put (sink , node_name (i));
+        line (" " , evals [i]);
+      }
+      detail::put (sink , "pattern_match\n");
+      for (std::size_t i = 0; i < node_kinds; ++ i) {
+        detail::put (sink , "  ");
+        detail::put (sink , node_name (i));
+        line (" " , matches [i]);
+      }
+      detail::put (sink , "allocations\n");
+      for (std::size_t i = 0; i < object_kinds; ++ i) {
+        detail::put (sink , "  ");
+        detail::put (sink , object_name (i));
+        detail::put (sink , " ");
+        detail::put_int (sink , static_cast <std::int64_t> (allocations [i]));
+        detail::put (sink , " (");
+        detail::put_int (sink , static_cast <std::int64_t> (bytes [i]));
+        detail::put (sink , " bytes)\n");
+      }
+      line ("closures " , closures);
+      line ("  captured total " , captured_total);
+      line ("  captured max " , captured_max);
+      line ("  frames total " , frames_total);
+      line ("  frames max " , frames_max);
+      line ("max depth " , max_depth);
+
+      struct row {
+        const object_t * lambda;
+        std::uint64_t count;
+        std::uint64_t self;
+        std::uint64_t total;
+      };
+      std::unordered_map <const object_t * , row> rows;
+      std::unordered_map <const object_t * , std::size_t> active;
+      std::vector <std::uint64_t> totals (calls.size ());
+      walk ([&] (std::size_t i) {
+        auto & c = calls [i];
+        if (c.lambda) {
+          auto & r = rows.emplace (c.lambda , row {c.lambda , 0 , 0 , 0}).first -> second;
+          r.count += c.count;
+          r.self += c.self;
+          ++ active [c.lambda];
+        }
+      } , [&] (std::size_t i) {
+        auto & c = calls [i];
+        totals [i] += c.self;
+        if (i != 0) {
+          totals [c.parent] += totals [i];
+        }
+        if (c.lambda && -- active [c.lambda] == 0) {
+          rows [c.lambda].total += totals [i];
+        }
+      });
+      std::vector <row> sorted;
+      for (auto && r : rows) {
+        sorted.push_back (r.second);
+      }
+      std::sort (sorted.begin () , sorted.end () , [] (const row & a , const row & b) {
+        return a.self > b.self;
+      });
+      detail::put (sink , "lambda calls self_us total_us\n");
+      for (auto && r : sorted) {
+        detail::put (sink , "  ");
+        put_lambda (sink , r.lambda);
+        detail::put (sink , " ");
+        detail::put_int (sink , static_cast <std::int64_t> (r.count));
+        detail::put (sink , " ");
+        detail::put_int (sink , static_cast <std::int64_t> (r.self / 1000));
+        detail::put (sink , " ");
+        detail::put_int (sink , static_cast <std::int64_t> (r.total / 1000));
+        detail::put (sink , "\n");
+      }
+    }
+
+    // flamegraph.pl などが読む collapsed stack の形式 (pro;f;g 自分の時間 [ns]) で書く
+    template <typename Sink>
+    auto collapsed (Sink & sink) const -> void {
+      std::vector <std::size_t> path;
+      walk ([&] (std::size_t i) {
+        path.push_back (i);
+        if (calls [i].self == 0) {
+          return;
+        }
+        for (std::size_t k = 0; k < path.size (); ++ k) {
+          if (k != 0) {
+            detail::put (sink , ";");
+          }
+          put_lambda (sink , calls [path [k]].lambda);
+        }
+        detail::put (sink , " ");
+        detail::put_int (sink , static_cast <std::int64_t> (calls [i].self));
+        detail::put (sink , "\n");
+      } , [&] (std::size_t) {
+        path.pop_back ();
+      });
+    }
+  };
+
+  namespace detail {
+    template <typename = void>
+    struct profile_holder {
+      static thread_local profile_t p;
+    };
+
+    template <typename T>
+    thread_local profile_t profile_holder <T>::p {};
+  }
+
+  inline auto profile () -> profile_t & {
+    return detail::profile_holder <>::p;
+  }
+
+  namespace detail {
+    inline auto profile_allocation (object_kind k , std::size_t bytes) noexcept -> void {
+      profile ().allocate (k , bytes);
+    }
+
+    struct profile_eval_scope {
+      explicit profile_eval_scope (std::size_t kind) {
+        profile ().enter_eval (kind);
+      }
+
+      ~ profile_eval_scope () {
+        profile ().leave_eval ();
+      }
+    };
+
+    struct profile_call_scope {
+      explicit profile_call_scope (const object_t * lambda) {
+        profile ().call (lambda);
+      }
+
+      ~ profile_call_scope () {
+        profile ().ret ();
+      }
+    };
+
+    // 末尾呼び出しは呼んだ側から戻ってから呼んだことにする. 抜けるときに最後の呼び出しから戻る
+    struct profile_tail_scope {
+      bool inside;
+
+      profile_tail_scope ()
+        : inside {false} {}
+
+      auto call (const object_t * lambda) -> void {
+        if (inside) {
+          profile ().ret ();
+        }
+        profile ().call (lambda);
+        inside = true;
+      }
+
+      ~ profile_tail_scope () {
+        if (inside) {
+          profile ().ret ();
+        }
+      }
+    };
+  }
+#endif
+
+  // ラムダ式でやろうとするとめっちゃエラーが出る(´・ω・｀)
+  inline auto show (const expression & p) {
+    return boost::apply_visitor (detail::show_f {} , p);
+  }
+
+  inline auto eval (const environ_t & env , const expression & p) {
+#ifdef PRO_PROFILE
+    detail::profile_eval_scope scope {static_cast <std::size_t> (p.which ())};
+#endif
+    return boost::apply_visitor (detail::eval_f {env} , p);
+  }
+
+  namespace detail {
+    // eval_tail が末尾でない部分式と葉をどう評価するか. 既定はそのまま eval で評価する.
+    // known は末尾位置の式の値が評価せずに分かるとき (memo_eval が覚えた値など) に value に入れて true を返す
+    struct direct_f {
+      template <typename E>
+      auto operator () (const environ_t & env , const E & e) const -> value_t {
+        return eval (env , e);
+      }
+
+      constexpr auto known (const expression & , value_t &) const noexcept {
+        return false;
+      }
+    };
+
+    // 末尾位置 (適用した関数の本体, letrec の本体, If の枝, Case の節) を持つノードはこれで評価する
+    template <typename T , typename Sub = direct_f>
+    inline auto eval_tail (const environ_t & env , const ref <T> & first , const Sub & sub = {}) -> value_t;
+  }
+
+  inline auto pattern_match (const expression & p , const value_t & e , environ_t & env) {
+#ifdef PRO_PROFILE
+    profile ().match (static_cast <std::size_t> (p.which ()));
+#endif
+    return boost::apply_visitor (detail::pattern_match_f {e , & env} , p);
+  }
+
+
+  struct void_value_t : object_t {
+    void_value_t () noexcept
+      : object_t {object_kind::syntax} {}
+  };
+
+  inline auto Void () {
+    return make <void_value_t> ();
+  }
+
+  inline auto show (const ref <void_value_t> &) {
+    return "()";
+  }
+
+  inline auto eval (const environ_t &, const ref <void_value_t> &) {
+    return value_t {};
+  }
+
+  inline auto pattern_match (const ref <void_value_t> & , const value_t & e , environ_t &) {
+    return e.is_void ();
+  }
+
+
+  struct int_value_t : object_t {
+    using value_type = std::int64_t;
+
+    value_type data;
+
+    int_value_t (value_type && d)
+      : object_t {object_kind::syntax}
+      , data (std::move (d)) {}
+  };
+
+  inline auto Int (int_value_t::value_type && d) {
+    return make <int_value_t> (std::move (d));
+  }
+
+  inline auto show (const ref <int_value_t> & p) {
+    std::string s;
+    detail::put_int (s , p -> data);
+    return s;
+  }
+
+  inline auto eval (const environ_t &, const ref <int_value_t> & p) {
+    return value_t::integer (p -> data);
+  }
+
+  inline auto pattern_match (const ref <int_value_t> & p , const value_t & e , environ_t &) {
+    return e.is_int () && e.as_int () == p -> data;
+  }
+
+
+  struct var_t : object_t {
+    using name_type = symbol;
+
+    name_type name;
+
+    var_t (name_type n)
+      : object_t {object_kind::syntax}
+      , name {n} {}
+  };
+
+  inline auto Var (symbol n) {
+    return make <var_t> (n);
+  }
+
+  inline auto Var (const std::string & n) {
+    return Var (intern (n));
+  }
+
+  inline auto show (const ref <var_t> & v) {
+    return "var:" + name_of (v -> name);
+  }
+
+
+  inline auto eval (const environ_t & env, const ref <var_t> & p) {
+    if (auto v = lookup (env , p -> name)) {
+      return force (* v);
+    }
+    std::stringstream ss;
+    ss << name_of (p -> name) << " is undefined.";
+    throw std::runtime_error {ss.str ()};
+  }
+
+  inline auto pattern_match (const ref <var_t> & xp , const value_t & e , environ_t & env) {
+    env = extend (env , xp -> name , e);
+    return true;
+  }
+
+
+  namespace detail {
+    inline auto free_of (const expression & arg , const expression & body) -> std::vector <symbol>;
+  }
+
+  struct lambda_t : object_t {
+    using arg_type = expression;
+    using body_type = expression;
+
+    arg_type arg;
+    body_type body;
+    // 本体の自由変数 (symbol の id 順). 作るときに求めて, 後からは書き換えない
+    std::vector <symbol> free;
+
+    lambda_t (arg_type && a , body_type && b)
+      : object_t {object_kind::syntax}
+      , arg {std::move (a)}
+      , body {std::move (b)}
+      , free {detail::free_of (arg , body)} {}
+  };
+
+  inline auto free_variables (const ref <lambda_t> & p) -> const std::vector <symbol> & {
+    return p -> free;
+  }
+
+  inline auto Lambda (lambda_t::arg_type && a , lambda_t::body_type && b) {
+    return make <lambda_t> (std::move (a) , std::move (b));
+  }
+
+  inline auto show (const ref <lambda_t> &) {
+    return "this is lambda.";
+  }
+
+  inline auto close (const environ_t & env , const ref <lambda_t> & p) -> ref <closure_t>;
+
+  inline auto eval (const environ_t & env , const ref <lambda_t> & p) {
+    return value_t {close (env , p)};
+  }
+
+  inline auto pattern_match (const ref <lambda_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. lambda is not a constructor."};
+  }
+
+
+  // 捕獲するのは lambda -> free に挙がった変数の値だけ. 並びも同じ
+  struct closure_t : object_t {
+    using lambda_type = ref <lambda_t>;
+
+    std::vector <value_t> captured;
+    lambda_type lambda;
+
+    closure_t (std::vector <value_t> && c , const lambda_type & l)
+      : object_t {object_kind::closure}
+      , captured {std::move (c)}
+      , lambda {l} {}
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      for (auto && v : captured) {
+        detail::push_child (v , out);
+      }
+    }
+
+    auto clear () -> void override {
+      captured.clear ();
+    }
+  };
+
+  namespace detail {
+    inline auto symbol_less (symbol a , symbol b) {
+      return a.id < b.id;
+    }
+  }
+
+  // 捕獲しようとした時点で未定義だった変数は undefined で入っていて, 使われたときに初めて undefined になる
+  inline auto lookup (const environ_t & env , symbol name) -> const value_t * {
+    for (auto f = env.frames.get (); f; f = f -> next.get ()) {
+      if (f -> name == name) {
+        return & f -> value;
+      }
+    }
+    if (auto c = env.closure.get ()) {
+      auto & fv = c -> lambda -> free;
+      auto ite = std::lower_bound (fv.begin () , fv.end () , name , detail::symbol_less);
+      if (ite != fv.end () && * ite == name) {
+        auto & v = c -> captured [ite - fv.begin ()];
+        return v.is_undefined () ? nullptr : & v;
+      }
+    }
+    return nullptr;
+  }
+
+  inline auto close (const environ_t & env , const ref <lambda_t> & p) -> ref <closure_t> {
+    auto & fv = free_variables (p);
+    std::vector <value_t> captured;
+    captured.reserve (fv.size ());
+    for (auto x : fv) {
+      auto v = lookup (env , x);
+      captured.push_back (v ? * v : value_t::undefined ());
+    }
+#ifdef PRO_PROFILE
+    std::size_t frames = 0;
+    for (auto f = env.frames.get (); f; f = f -> next.get ()) {
+      ++ frames;
+    }
+    profile ().close (captured.size () , frames);
+    detail::profile_allocation (object_kind::closure , captured.capacity () * sizeof (value_t));
+#endif
+    return make <closure_t> (std::move (captured) , p);
+  }
+
+
+  struct apply_t : object_t {
+    using func_type = expression;
+    using expr_type = expression;
+
+    func_type func;
+    expr_type expr;
+
+    apply_t (func_type && f , expr_type && e)
+      : object_t {object_kind::syntax}
+      , func {std::move (f)}
+      , expr {std::move (e)} {}
+  };
+
+  inline auto Apply (apply_t::func_type && f , apply_t::expr_type && e) {
+    return make <apply_t> (std::move (f) , std::move (e));
+  }
+
+  inline auto Let (expression && a , expression && e , expression && b) {
+    return Apply (Lambda (std::move (a) , std::move (b)) , std::move (e));
+  }
+
+  inline auto show (const ref <apply_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  // マッチの失敗は例外にせず result で返す. 例外にするかどうかは呼び出し側が決める.
+  enum class failure : std::uint8_t {
+    none ,
+    not_a_function ,
+    match_failure ,
+    not_an_integer ,
+    division_by_zero ,
+    not_a_vector ,
+    out_of_range ,
+  };
+
+  inline auto message (failure f) -> const char * {
+    switch (f) {
+      case failure::none:
+        return "";
+      case failure::not_a_function:
+        return "the object <which is not a function> cannot apply.";
+      case failure::match_failure:
+        return "failed pattern match.";
+      case failure::not_an_integer:
+        return "the object <which is not an integer> cannot compute.";
+      case failure::division_by_zero:
+        return "division by zero.";
+      case failure::not_a_vector:
+        return "the object <which is not a vector> cannot index.";
+      case failure::out_of_range:
+        return "index out of range.";
+    }
+    return "";
+  }
+
+  template <typename T>
+  struct result {
+    T value;
+    failure error;
+
+    explicit operator bool () const noexcept {
+      return error == failure::none;
+    }
+  };
+
+  inline auto apply (closure_t * f , const value_t & e) -> result <value_t> {
+#ifdef PRO_PROFILE
+    detail::profile_call_scope scope {f -> lambda.get ()};
+#endif
+    environ_t new_env {{} , ref <closure_t> {f}};
+    if (! pattern_match (f -> lambda -> arg , e , new_env)) {
+      return {value_t {} , failure::match_failure};
+    }
+    return {eval (new_env , f -> lambda -> body) , failure::none};
+  }
+
+  inline auto apply (const value_t & f , const value_t & e) -> result <value_t> {
+    if (f.is (object_kind::closure)) {
+      return apply (f.get <closure_t> () , e);
+    }
+    return {value_t {} , failure::not_a_function};
+  }
+
+#ifdef PRO_PROFILE
+  namespace detail {
+    // Let (Var (x) , e , body) の body は let:x と呼び, e が Lambda ならそれを x と呼ぶ
+    inline auto profile_names (const apply_t & p) -> void {
+      if (auto l = boost::get <ref <lambda_t>> (& p.func)) {
+        if (auto x = boost::get <ref <var_t>> (& (* l) -> arg)) {
+          profile ().name (l -> get () , (* x) -> name , "let:");
+          if (auto g = boost::get <ref <lambda_t>> (& p.expr)) {
+            profile ().name (g -> get () , (* x) -> name);
+          }
+        }
+      }
+    }
+  }
+#endif
+
+  inline auto eval (const environ_t & env, const ref <apply_t> & p) {
+    return detail::eval_tail (env , p);
+  }
+
+  inline auto pattern_match (const ref <apply_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. function apply is not a constructor."};
+  }
+
+
+  // LetRec (Var (f) , Lambda (...) , body). f は Lambda の中からも見える.
+  // クロージャは f の値として自分自身を捕獲するので, 再帰呼び出しは捕獲した値を読むだけで環境を作り直さない.
+  struct letrec_t : object_t {
+    using name_type = symbol;
+    using func_type = ref <lambda_t>;
+    using body_type = expression;
+
+    name_type name;
+    func_type func;
+    body_type body;
+
+    letrec_t (expression && a , expression && e , body_type && b)
+      : object_t {object_kind::syntax}
+      , name {}
+      , func {}
+      , body {std::move (b)} {
+      auto x = boost::get <ref <var_t>> (& a);
+      auto l = boost::get <ref <lambda_t>> (& e);
+      if (! x || ! l) {
+        throw std::runtime_error {"letrec binds only a variable to a lambda."};
+      }
+      name = (* x) -> name;
+      func = std::move (* l);
+    }
+  };
+
+  inline auto LetRec (expression && a , expression && e , letrec_t::body_type && b) {
+    return make <letrec_t> (std::move (a) , std::move (e) , std::move (b));
+  }
+
+  inline auto show (const ref <letrec_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  inline auto close (const environ_t & env , const ref <letrec_t> & p) -> ref <closure_t> {
+    auto c = close (env , p -> func);
+    auto & fv = p -> func -> free;
+    auto ite = std::lower_bound (fv.begin () , fv.end () , p -> name , detail::symbol_less);
+    if (ite != fv.end () && * ite == p -> name) {
+      c -> captured [ite - fv.begin ()] = value_t {c};
+    }
+    return c;
+  }
+
+  inline auto eval (const environ_t & env , const ref <letrec_t> & p) {
+    return detail::eval_tail (env , p);
+  }
+
+  inline auto pattern_match (const ref <letrec_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. letrec is not a constructor."};
+  }
+
+
+  // 永続ベクタ. 作ったら変わらず, push や update は新しいベクタを返して, 変わらない部分を元のものと共有する.
+  // 末尾の 32 個までは tail に並べて持ち, それより前は 32 個ずつの葉を 32 分木にして持つ (Clojure のベクタと同じ形).
+  // 32 個までなら tail だけの連続した配列で, 大きくなっても 1 回引くのに log32 (n) 段しか辿らない
+  namespace detail {
+    constexpr std::uint32_t vector_bits = 5;
+    constexpr std::size_t vector_width = std::size_t {1} << vector_bits;
+    constexpr std::size_t vector_mask = vector_width - 1;
+  }
+
+  // 木の節. 葉は 32 個の要素で埋まっていて, 枝は子の節を前から詰めて並べる (空きは void).
+  // 節 1 つを 1 回の確保で作れるよう, 中身は節の中に持つ
+  struct vector_node_t : object_t {
+    std::array <value_t , detail::vector_width> slots;
+
+    vector_node_t ()
+      : object_t {object_kind::vector_node}
+      , slots {} {}
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      for (auto && v : slots) {
+        detail::push_child (v , out);
+      }
+    }
+
+    auto clear () -> void override {
+      slots.fill (value_t {});
+    }
+  };
+
+  struct vector_t : object_t {
+    std::size_t count;
+    // 根の節で添字の何ビット目から引くか. 根が葉なら 0
+    std::uint32_t shift;
+    // 木が空なら void
+    value_t root;
+    // 末尾の 1 .. 32 個. 空のベクタなら 0 個
+    std::vector <value_t> tail;
+
+    vector_t (std::size_t n , std::uint32_t s , value_t && r , std::vector <value_t> && t)
+      : object_t {object_kind::vector}
+      , count {n}
+      , shift {s}
+      , root {std::move (r)}
+      , tail {std::move (t)} {}
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      detail::push_child (root , out);
+      for (auto && v : tail) {
+        detail::push_child (v , out);
+      }
+    }
+
+    auto clear () -> void override {
+      root = value_t {};
+      tail.clear ();
+    }
+
+    auto size () const noexcept {
+      return count;
+    }
+
+    // 木に入っている要素の数. tail はその次から始まる
+    auto tail_offset () const noexcept {
+      return count - tail.size ();
+    }
+
+    // i < size () のときだけ呼ぶ
+    auto operator [] (std::size_t i) const noexcept -> const value_t & {
+      auto offset = tail_offset ();
+      if (i >= offset) {
+        return tail [i - offset];
+      }
+      auto node = root.get <vector_node_t> ();
+      for (auto level = shift; level > 0; level -= detail::vector_bits) {
+        node = node -> slots [(i >> level) & detail::vector_mask].get <vector_node_t> ();
+      }
+      return node -> slots [i & detail::vector_mask];
+    }
+  };
+
+  namespace detail {
+    // [first , last) (32 個まで) を前から詰めた節
+    template <typename Iterator>
+    inline auto make_node (Iterator first , Iterator last) {
+      auto p = make <vector_node_t> ();
+      std::copy (first , last , p -> slots.begin ());
+      return value_t {p};
+    }
+
+    // 高さ level で, 葉 leaf だけに続く枝の列
+    inline auto vector_path (std::uint32_t level , value_t && leaf) -> value_t {
+      if (level == 0) {
+        return std::move (leaf);
+      }
+      auto p = make <vector_node_t> ();
+      p -> slots [0] = vector_path (level - vector_bits , std::move (leaf));
+      return value_t {p};
+    }
+
+    // 高さ level の節 node の, 添字 index の位置に葉を足した節. node は書き換えない
+    inline auto vector_push_leaf (const vector_node_t & node , std::uint32_t level , std::size_t index , value_t && leaf) -> value_t {
+      auto p = make <vector_node_t> ();
+      p -> slots = node.slots;
+      auto & slot = p -> slots [(index >> level) & vector_mask];
+      if (level == vector_bits) {
+        slot = std::move (leaf);
+      }
+      else if (! slot.is_void ()) {
+        slot = vector_push_leaf (* slot.get <vector_node_t> () , level - vector_bits , index , std::move (leaf));
+      }
+      else {
+        slot = vector_path (level - vector_bits , std::move (leaf));
+      }
+      return value_t {p};
+    }
+
+    // 高さ level の節 node の, 添字 index の要素を x にした節. 通り道の節だけを作り直す
+    inline auto vector_assoc (const vector_node_t & node , std::uint32_t level , std::size_t index , const value_t & x) -> value_t {
+      auto p = make <vector_node_t> ();
+      p -> slots = node.slots;
+      auto & slot = p -> slots [(index >> level) & vector_mask];
+      slot = level == 0 ? x : vector_assoc (* slot.get <vector_node_t> () , level - vector_bits , index , x);
+      return value_t {p};
+    }
+  }
+
+  // xs を並べたベクタ. 葉を下から 32 個ずつまとめて一度に木を作る
+  inline auto make_vector (std::vector <value_t> && xs) -> ref <vector_t> {
+    auto n = xs.size ();
+    auto offset = n == 0 ? 0 : (n - 1) & ~ detail::vector_mask;
+    std::vector <value_t> nodes;
+    std::uint32_t shift = 0;
+    for (std::size_t i = 0; i < offset; i += detail::vector_width) {
+      nodes.push_back (detail::make_node (std::make_move_iterator (xs.begin () + i) , std::make_move_iterator (xs.begin () + i + detail::vector_width)));
+    }
+    while (nodes.size () > 1) {
+      std::vector <value_t> parents;
+      for (std::size_t i = 0; i < nodes.size (); i += detail::vector_width) {
+        auto last = std::min (i + detail::vector_width , nodes.size ());
+        parents.push_back (detail::make_node (std::make_move_iterator (nodes.begin () + i) , std::make_move_iterator (nodes.begin () + last)));
+      }
+      nodes = std::move (parents);
+      shift += detail::vector_bits;
+    }
+    std::vector <value_t> tail {std::make_move_iterator (xs.begin () + offset) , std::make_move_iterator (xs.end ())};
+    return make <vector_t> (n , shift , nodes.empty () ? value_t {} : std::move (nodes.front ()) , std::move (tail));
+  }
+
+  // v の後ろに x を足したベクタ. tail が一杯なら葉にして木に入れる
+  inline auto push (const vector_t & v , const value_t & x) -> ref <vector_t> {
+    if (v.tail.size () < detail::vector_width) {
+      std::vector <value_t> tail;
+      tail.reserve (v.tail.size () + 1);
+      tail.assign (v.tail.begin () , v.tail.end ());
+      tail.push_back (x);
+      return make <vector_t> (v.count + 1 , v.shift , value_t {v.root} , std::move (tail));
+    }
+    auto leaf = detail::make_node (v.tail.begin () , v.tail.end ());
+    auto offset = v.tail_offset ();
+    auto shift = v.shift;
+    value_t root;
+    if (v.root.is_void ()) {
+      root = std::move (leaf);
+    }
+    // 根が一杯なら 1 段高くする
+    else if (offset == (detail::vector_width << v.shift)) {
+      auto p = make <vector_node_t> ();
+      p -> slots [0] = v.root;
+      p -> slots [1] = detail::vector_path (v.shift , std::move (leaf));
+      root = value_t {p};
+      shift += detail::vector_bits;
+    }
+    else {
+      root = detail::vector_push_leaf (* v.root.get <vector_node_t> () , v.shift , offset , std::move (leaf));
+    }
+    return make <vector_t> (v.count + 1 , shift , std::move (root) , std::vector <value_t> {x});
+  }
+
+  // v の i 番目を x にしたベクタ. i < v.size () のときだけ呼ぶ
+  inline auto update (const vector_t & v , std::size_t i , const value_t & x) -> ref <vector_t> {
+    auto offset = v.tail_offset ();
+    if (i >= offset) {
+      auto tail = v.tail;
+      tail [i - offset] = x;
+      return make <vector_t> (v.count , v.shift , value_t {v.root} , std::move (tail));
+    }
+    return make <vector_t> (v.count , v.shift , detail::vector_assoc (* v.root.get <vector_node_t> () , v.shift , i , x) , std::vector <value_t> {v.tail});
+  }
+
+
+  // Tuple ({e ...}). 要素を前から順に評価して, それを並べたベクタを作る.
+  // パターンとしては同じ長さのベクタに合い, 要素ごとに照合して束縛する
+  struct tuple_t : object_t {
+    using expr_type = expression;
+
+    std::vector <expr_type> elements;
+
+    explicit tuple_t (std::vector <expr_type> && es)
+      : object_t {object_kind::syntax}
+      , elements {std::move (es)} {}
+  };
+
+  inline auto Tuple (std::vector <tuple_t::expr_type> && es) {
+    return make <tuple_t> (std::move (es));
+  }
+
+  inline auto show (const ref <tuple_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  inline auto eval (const environ_t & env , const ref <tuple_t> & p) {
+    std::vector <value_t> xs;
+    xs.reserve (p -> elements.size ());
+    for (auto && e : p -> elements) {
+      xs.push_back (eval (env , e));
+    }
+    return value_t {make_vector (std::move (xs))};
+  }
+
+  inline auto pattern_match (const ref <tuple_t> & p , const value_t & e , environ_t & env) {
+    if (! e.is (object_kind::vector) || e.get <vector_t> () -> size () != p -> elements.size ()) {
+      return false;
+    }
+    auto & v = * e.get <vector_t> ();
+    for (std::size_t i = 0; i < v.size (); ++ i) {
+      if (! pattern_match (p -> elements [i] , v [i] , env)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  // 整数の二項演算とベクタの演算. 比較は真なら 1, 偽なら 0 を返す.
+  // index は (v , i) の i 番目, size は v の長さ (右は使わない), push は v の後ろに右を足したもの,
+  // update は右のタプル (i , x) で v の i 番目を x にしたもの
+  enum class primitive : std::uint8_t {
+    add ,
+    sub ,
+    mul ,
+    div ,
+    mod ,
+    less ,
+    less_equal ,
+    greater ,
+    greater_equal ,
+    equal ,
+    not_equal ,
+    index ,
+    size ,
+    push ,
+    update ,
+  };
+
+  namespace detail {
+    // 符号付きの溢れは未定義なので, 符号なしで計算して 2 の補数で折り返す
+    template <typename F>
+    inline auto wrapping (F f , std::int64_t a , std::int64_t b) {
+      return static_cast <std::int64_t> (f (static_cast <std::uint64_t> (a) , static_cast <std::uint64_t> (b)));
+    }
+
+    inline auto truth (bool b) {
+      return value_t::integer (b ? 1 : 0);
+    }
+  }
+
+  inline auto compute (primitive op , std::int64_t a , std::int64_t b) -> result <value_t> {
+    switch (op) {
+      case primitive::add:
+        return {value_t::integer (detail::wrapping (gomi::plus_t {} , a , b)) , failure::none};
+      case primitive::sub:
+        return {value_t::integer (detail::wrapping (gomi::minus_t {} , a , b)) , failure::none};
+      case primitive::mul:
+        return {value_t::integer (detail::wrapping (gomi::multiplies_t {} , a , b)) , failure::none};
+      case primitive::div:
+      case primitive::mod:
+        if (b == 0) {
+          return {value_t {} , failure::division_by_zero};
+        }
+        // INT64_MIN / -1 も溢れる. 折り返すと商は a, 余りは 0
+        if (b == -1) {
+          return {value_t::integer (op == primitive::div ? detail::wrapping (gomi::minus_t {} , 0 , a) : 0) , failure::none};
+        }
+        return {value_t::integer (op == primitive::div ? gomi::divides_t {} (a , b) : gomi::modulus_t {} (a , b)) , failure::none};
+      case primitive::less:
+        return {detail::truth (gomi::less_t {} (a , b)) , failure::none};
+      case primitive::less_equal:
+        return {detail::truth (gomi::less_equal_t {} (a , b)) , failure::none};
+      case primitive::greater:
+        return {detail::truth (gomi::greater_t {} (a , b)) , failure::none};
+      case primitive::greater_equal:
+        return {detail::truth (gomi::greater_equal_t {} (a , b)) , failure::none};
+      case primitive::equal:
+        return {detail::truth (gomi::equal_to_t {} (a , b)) , failure::none};
+      case primitive::not_equal:
+        return {detail::truth (gomi::not_equal_to_t {} (a , b)) , failure::none};
+      case primitive::index:
+      case primitive::size:
+      case primitive::push:
+      case primitive::update:
+        return {value_t {} , failure::not_a_vector};
+    }
+    return {value_t {} , failure::none};
+  }
+
+  namespace detail {
+    // 左がベクタの演算
+    inline auto compute_vector (primitive op , const value_t & a , const value_t & b) -> result <value_t> {
+      if (! a.is (object_kind::vector)) {
+        return {value_t {} , failure::not_a_vector};
+      }
+      auto & v = * a.get <vector_t> ();
+      auto position = [&] (const value_t & i) {
+        return i.as_int () >= 0 && static_cast <std::uint64_t> (i.as_int ()) < v.size ();
+      };
+      switch (op) {
+        case primitive::index:
+          if (! b.is_int ()) {
+            return {value_t {} , failure::not_an_integer};
+          }
+          if (! position (b)) {
+            return {value_t {} , failure::out_of_range};
+          }
+          return {v [static_cast <std::size_t> (b.as_int ())] , failure::none};
+        case primitive::size:
+          return {value_t::integer (static_cast <std::int64_t> (v.size ())) , failure::none};
+        case primitive::push:
+          return {value_t {push (v , b)} , failure::none};
+        case primitive::update: {
+          // 右は (i , x) のタプル
+          if (! b.is (object_kind::vector) || b.get <vector_t> () -> size () != 2) {
+            return {value_t {} , failure::match_failure};
+          }
+          auto & i = (* b.get <vector_t> ()) [0];
+          if (! i.is_int ()) {
+            return {value_t {} , failure::not_an_integer};
+          }
+          if (! position (i)) {
+            return {value_t {} , failure::out_of_range};
+          }
+          return {value_t {update (v , static_cast <std::size_t> (i.as_int ()) , (* b.get <vector_t> ()) [1])} , failure::none};
+        }
+        default:
+          return {value_t {} , failure::not_an_integer};
+      }
+    }
+  }
+
+  // 両方が即値の整数なら箱を見に行かずに済む
+  inline auto compute (primitive op , const value_t & a , const value_t & b) -> result <value_t> {
+    if (a.is_small () && b.is_small ()) {
+      return compute (op , a.as_small () , b.as_small ());
+    }
+    if (op >= primitive::index) {
+      return detail::compute_vector (op , a , b);
+    }
+    if (! a.is_int () || ! b.is_int ()) {
+      return {value_t {} , failure::not_an_integer};
+    }
+    return compute (op , a.as_int () , b.as_int ());
+  }
+
+  struct prim_t : object_t {
+    using expr_type = expression;
+
+    primitive op;
+    expr_type lhs;
+    expr_type rhs;
+
+    prim_t (primitive o , expr_type && l , expr_type && r)
+      : object_t {object_kind::syntax}
+      , op {o}
+      , lhs {std::move (l)}
+      , rhs {std::move (r)} {}
+  };
+
+  inline auto Prim (primitive op , prim_t::expr_type && l , prim_t::expr_type && r) {
+    return make <prim_t> (op , std::move (l) , std::move (r));
+  }
+
+  inline auto Add (expression && l , expression && r) {
+    return Prim (primitive::add , std::move (l) , std::move (r));
+  }
+
+  inline auto Sub (expression && l , expression && r) {
+    return Prim (primitive::sub , std::move (l) , std::move (r));
+  }
+
+  inline auto Mul (expression && l , expression && r) {
+    return Prim (primitive::mul , std::move (l) , std::move (r));
+  }
+
+  inline auto Div (expression && l , expression && r) {
+    return Prim (primitive::div , std::move (l) , std::move (r));
+  }
+
+  inline auto Mod (expression && l , expression && r) {
+    return Prim (primitive::mod , std::move (l) , std::move (r));
+  }
+
+  inline auto Less (expression && l , expression && r) {
+    return Prim (primitive::less , std::move (l) , std::move (r));
+  }
+
+  inline auto LessEqual (expression && l , expression && r) {
+    return Prim (primitive::less_equal , std::move (l) , std::move (r));
+  }
+
+  inline auto Greater (expression && l , expression && r) {
+    return Prim (primitive::greater , std::move (l) , std::move (r));
+  }
+
+  inline auto GreaterEqual (expression && l , expression && r) {
+    return Prim (primitive::greater_equal , std::move (l) , std::move (r));
+  }
+
+  inline auto Equal (expression && l , expression && r) {
+    return Prim (primitive::equal , std::move (l) , std::move (r));
+  }
+
+  inline auto NotEqual (expression && l , expression && r) {
+    return Prim (primitive::not_equal , std::move (l) , std::move (r));
+  }
+
+  inline auto Index (expression && v , expression && i) {
+    return Prim (primitive::index , std::move (v) , std::move (i));
+  }
+
+  inline auto Size (expression && v) {
+    return Prim (primitive::size , std::move (v) , Void ());
+  }
+
+  inline auto Push (expression && v , expression && x) {
+    return Prim (primitive::push , std::move (v) , std::move (x));
+  }
+
+  inline auto Update (expression && v , expression && i , expression && x) {
+    std::vector <expression> pair;
+    pair.push_back (std::move (i));
+    pair.push_back (std::move (x));
+    return Prim (primitive::update , std::move (v) , Tuple (std::move (pair)));
+  }
+
+  inline auto show (const ref <prim_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  inline auto eval (const environ_t & env , const ref <prim_t> & p) {
+    auto a = eval (env , p -> lhs);
+    auto b = eval (env , p -> rhs);
+    auto r = compute (p -> op , a , b);
+    if (! r) {
+      throw std::runtime_error {message (r.error)};
+    }
+    return std::move (r.value);
+  }
+
+  inline auto pattern_match (const ref <prim_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. primitive is not a constructor."};
+  }
+
+
+  // If (test , consequent , alternative). test が 0 以外の整数なら consequent, 0 なら alternative を評価する.
+  struct if_t : object_t {
+    using expr_type = expression;
+
+    expr_type test;
+    expr_type consequent;
+    expr_type alternative;
+
+    if_t (expr_type && t , expr_type && c , expr_type && a)
+      : object_t {object_kind::syntax}
+      , test {std::move (t)}
+      , consequent {std::move (c)}
+      , alternative {std::move (a)} {}
+  };
+
+  inline auto If (if_t::expr_type && t , if_t::expr_type && c , if_t::expr_type && a) {
+    return make <if_t> (std::move (t) , std::move (c) , std::move (a));
+  }
+
+  inline auto show (const ref <if_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  // 選ばなかった枝は評価しない
+  inline auto branch (const if_t & p , const value_t & test) -> const expression * {
+    if (! test.is_int ()) {
+      return nullptr;
+    }
+    return test.as_int () != 0 ? & p.consequent : & p.alternative;
+  }
+
+  inline auto eval (const environ_t & env , const ref <if_t> & p) -> value_t {
+    return detail::eval_tail (env , p);
+  }
+
+  inline auto pattern_match (const ref <if_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. if is not a constructor."};
+  }
+
+
+  struct clause_t {
+    expression pattern;
+    expression body;
+  };
+
+  namespace detail {
+    // 振り分け表を引く. 表の中身は配列で受け取るので, case_table_t からでもメモリに写した像からでも使える
+    inline auto select_case (
+      std::int64_t base ,
+      const std::uint32_t * dense , std::size_t dense_size ,
+      const std::pair <std::int64_t , std::uint32_t> * sparse , std::size_t sparse_size ,
+      std::uint32_t on_void , std::uint32_t on_other ,
+      const value_t & v
+    ) -> std::uint32_t {
+      if (v.is_int ()) {
+        auto k = v.as_int ();
+        if (dense_size != 0) {
+          auto d = static_cast <std::uint64_t> (k) - static_cast <std::uint64_t> (base);
+          return d < dense_size ? dense [d] : on_other;
+        }
+        auto ite = std::lower_bound (sparse , sparse + sparse_size , k , [] (const auto & e , std::int64_t x) {
+          return e.first < x;
+        });
+        return ite != sparse + sparse_size && ite -> first == k ? ite -> second : on_other;
+      }
+      return v.is_void () ? on_void : on_other;
+    }
+  }
+
+  // 節の振り分け表. 行き先は節の番号 (VM ではコードの位置).
+  // 整数のリテラルが詰まっていれば base からの配列を引き, 散らばっていれば整列した配列を二分探索する.
+  struct case_table_t {
+    static constexpr std::uint32_t none = static_cast <std::uint32_t> (-1);
+
+    std::int64_t base;
+    std::vector <std::uint32_t> dense;
+    std::vector <std::pair <std::int64_t , std::uint32_t>> sparse;
+    std::uint32_t on_void;
+    // 表に無い整数とそれ以外の値. 変数の節が無ければ none
+    std::uint32_t on_other;
+
+    auto select (const value_t & v) const -> std::uint32_t {
+      return detail::select_case (base , dense.data () , dense.size () , sparse.data () , sparse.size () , on_void , on_other , v);
+    }
+
+    // 行き先を付け替える
+    template <typename F>
+    auto map (F && f) {
+      auto g = [&] (std::uint32_t & t) {
+        if (t != none) {
+          t = f (t);
+        }
+      };
+      for (auto && t : dense) {
+        g (t);
+      }
+      for (auto && e : sparse) {
+        g (e.second);
+      }
+      g (on_void);
+      g (on_other);
+    }
+  };
+
+  namespace detail {
+    // 上から順に試したときに勝つ節を値の種類と整数ごとに決めておく
+    inline auto make_case_table (const std::vector <clause_t> & clauses) -> case_table_t {
+      constexpr auto none = case_table_t::none;
+      case_table_t t {0 , {} , {} , none , none};
+      for (std::uint32_t i = 0; i < clauses.size () && t.on_other == none; ++ i) {
+        auto & pattern = clauses [i].pattern;
+        if (auto n = boost::get <ref <int_value_t>> (& pattern)) {
+          auto k = (* n) -> data;
+          if (std::find_if (t.sparse.begin () , t.sparse.end () , [&] (const auto & e) { return e.first == k; }) == t.sparse.end ()) {
+            t.sparse.emplace_back (k , i);
+          }
+        }
+        else if (boost::get <ref <void_value_t>> (& pattern)) {
+          if (t.on_void == none) {
+            t.on_void = i;
+          }
+        }
+        else if (boost::get <ref <var_t>> (& pattern)) {
+          t.on_other = i;
+        }
+        else {
+          throw std::runtime_error {"case clauses match only Int, Void or a variable."};
+        }
+      }
+      if (t.on_void == none) {
+        t.on_void = t.on_other;
+      }
+      std::sort (t.sparse.begin () , t.sparse.end ());
+      if (! t.sparse.empty ()) {
+        auto span = static_cast <std::uint64_t> (t.sparse.back ().first) - static_cast <std::uint64_t> (t.sparse.front ().first);
+        if (span < 4 * t.sparse.size ()) {
+          t.base = t.sparse.front ().first;
+          t.dense.assign (span + 1 , t.on_other);
+          for (auto && e : t.sparse) {
+            t.dense [static_cast <std::uint64_t> (e.first) - static_cast <std::uint64_t> (t.base)] = e.second;
+          }
+          t.sparse.clear ();
+        }
+      }
+      return t;
+    }
+  }
+
+  // Case (e , {{pattern , body} ...}). 上から順にパターンを試すのと同じ結果を, 振り分け表を 1 回引いて得る.
+  // パターンは Int, Void, 変数のどれか.
+  struct match_t : object_t {
+    using expr_type = expression;
+
+    expr_type scrutinee;
+    std::vector <clause_t> clauses;
+    case_table_t table;
+
+    match_t (expr_type && e , std::vector <clause_t> && cs)
+      : object_t {object_kind::syntax}
+      , scrutinee {std::move (e)}
+      , clauses {std::move (cs)}
+      , table {detail::make_case_table (clauses)} {}
+
+    // 節 i が束縛する変数. 無ければ nullptr
+    auto binder (std::uint32_t i) const -> const var_t * {
+      auto x = boost::get <ref <var_t>> (& clauses [i].pattern);
+      return x ? x -> get () : nullptr;
+    }
+  };
+
+  inline auto Case (match_t::expr_type && e , std::vector <clause_t> && cs) {
+    return make <match_t> (std::move (e) , std::move (cs));
+  }
+
+  namespace detail {
+    // Function の引数の名前. 節の本体からは見えない (パーサが読める名前ではない)
+    inline auto case_argument () {
+      static const auto x = intern ("%case");
+      return x;
+    }
+  }
+
+  // 節をいくつも持つラムダ. Lambda (x , Case (x , clauses)) と同じ
+  inline auto Function (std::vector <clause_t> && cs) {
+    return Lambda (Var (detail::case_argument ()) , Case (Var (detail::case_argument ()) , std::move (cs)));
+  }
+
+  inline auto show (const ref <match_t> &) {
+    return "cannot show unevalated value.";
+  }
+
+  inline auto eval (const environ_t & env , const ref <match_t> & p) -> value_t {
+    return detail::eval_tail (env , p);
+  }
+
+  inline auto pattern_match (const ref <match_t> & , const value_t & , environ_t &) -> bool {
+    throw std::runtime_error {"failed pattern match. case is not a constructor."};
+  }
+
+
+  namespace detail {
+    // 末尾位置 (適用した関数の本体, letrec の本体, If の枝, Case の節) に進むか, 値を出して終わるかの 1 歩.
+    // e が指すノードは, 今の環境のクロージャ (が捕獲したラムダ) か, 一番外の式を持っている呼び出し元が持っている
+    template <typename Sub>
+    struct tail_f {
+      const Sub & sub;
+      const environ_t * & env;
+      const expression * & e;
+      // 末尾位置で作った環境. 呼び出し元の環境は書き換えない
+      environ_t & tail;
+      value_t & value;
+#ifdef PRO_PROFILE
+      profile_tail_scope & calls;
+#endif
+
+      auto enter (environ_t && next , const expression & body) const -> bool {
+        e = & body;
+        tail = std::move (next);
+        env = & tail;
+        return false;
+      }
+
+      template <typename T>
+      auto operator () (const T & p) const -> bool {
+        value = sub (* env , p);
+        return true;
+      }
+
+      auto operator () (const ref <apply_t> & p) const -> bool {
+#ifdef PRO_PROFILE
+        profile_names (* p);
+#endif
+        value_t f = sub (* env , p -> func);
+        if (! f.is (object_kind::closure)) {
+          throw std::runtime_error {message (failure::not_a_function)};
+        }
+        value_t x = sub (* env , p -> expr);
+        auto c = f.get <closure_t> ();
+#ifdef PRO_PROFILE
+        calls.call (c -> lambda.get ());
+#endif
+        environ_t next {{} , ref <closure_t> {c}};
+        if (! pattern_match (c -> lambda -> arg , x , next)) {
+          throw std::runtime_error {message (failure::match_failure)};
+        }
+        return enter (std::move (next) , c -> lambda -> body);
+      }
+
+      auto operator () (const ref <letrec_t> & p) const -> bool {
+#ifdef PRO_PROFILE
+        profile ().name (p -> func.get () , p -> name);
+#endif
+        return enter (extend (* env , p -> name , close (* env , p)) , p -> body);
+      }
+
+      auto operator () (const ref <if_t> & p) const -> bool {
+        e = branch (* p , sub (* env , p -> test));
+        if (! e) {
+          throw std::runtime_error {message (failure::not_an_integer)};
+        }
+        return false;
+      }
+
+      auto operator () (const ref <match_t> & p) const -> bool {
+        value_t v = sub (* env , p -> scrutinee);
+        auto i = p -> table.select (v);
+        if (i == case_table_t::none) {
+          throw std::runtime_error {message (failure::match_failure)};
+        }
+        if (auto x = p -> binder (i)) {
+          return enter (extend (* env , x -> name , v) , p -> clauses [i].body);
+        }
+        e = & p -> clauses [i].body;
+        return false;
+      }
+    };
+
+    // 末尾位置は呼び出さずにこのループで続けて評価するので, 末尾呼び出しがいくら続いてもネイティブスタックは伸びない
+    // (run や VM と同じ). 葉や演算は eval から直に評価して, ループの支度はしない
+    template <typename T , typename Sub>
+    inline auto eval_tail (const environ_t & env , const ref <T> & first , const Sub & sub) -> value_t {
+      const environ_t * en = & env;
+      const expression * e = nullptr;
+      environ_t tail;
+      value_t value;
+#ifdef PRO_PROFILE
+      profile_tail_scope calls;
+      tail_f <Sub> step {sub , en , e , tail , value , calls};
+      for (auto done = step (first); ! done;) {
+        profile_eval_scope scope {static_cast <std::size_t> (e -> which ())};
+        done = sub.known (* e , value) || boost::apply_visitor (step , * e);
+      }
+#else
+      tail_f <Sub> step {sub , en , e , tail , value};
+      for (auto done = step (first); ! done; done = sub.known (* e , value) || boost::apply_visitor (step , * e)) {}
+#endif
+      return value;
+    }
+  }
+
+
+  // 必要呼び (call-by-need) で束縛された, まだ評価していない式. 一度評価したら値を覚えておく.
+  struct thunk_t : object_t {
+    expression expr;
+    environ_t env;
+    value_t value;
+    bool forced;
+
+    thunk_t (const expression & e , const environ_t & en)
+      : object_t {object_kind::thunk}
+      , expr {e}
+      , env {en}
+      , value {}
+      , forced {false} {}
+
+    // 評価し終わったら式と環境は要らないので離す
+    auto update (const value_t & v) {
+      value = v;
+      forced = true;
+      expr = expression {};
+      env = environ_t {};
+    }
+
+    auto children (std::vector <object_t *> & out) const -> void override {
+      detail::push_child (env.frames , out);
+      detail::push_child (env.closure , out);
+      detail::push_child (value , out);
+    }
+
+    auto clear () -> void override {
+      expr = expression {};
+      env = environ_t {};
+      value = value_t {};
+    }
+  };
+
+  inline auto force (const value_t & v) -> value_t {
+    if (! v.is (object_kind::thunk)) {
+      return v;
+    }
+    auto t = v.get <thunk_t> ();
+    if (! t -> forced) {
+      t -> update (eval (t -> env , t -> expr));
+    }
+    return t -> value;
+  }
+
+  // v を sink に書き足す. 途中で文字列を作らないので, 1 つのバッファに続けて書ける.
+  // ベクタは (tuple x ...) と書く. 入れ子が深くても再帰せず, 書きかけのベクタと次の添字を積んで辿る
+  template <typename Sink>
+  inline auto show_to (Sink & sink , const value_t & v) -> decltype (sink.append ("" , 0) , void ()) {
+    std::vector <std::pair <const vector_t * , std::size_t>> open;
+    auto p = & v;
+    for (;;) {
+      // 評価済みのサンクは中身を書く
+      while (p -> is (object_kind::thunk) && p -> get <thunk_t> () -> forced) {
+        p = & p -> get <thunk_t> () -> value;
+      }
+      if (p -> is_void ()) {
+        detail::put (sink , "()");
+      }
+      else if (p -> is_int ()) {
+        detail::put_int (sink , p -> as_int ());
+      }
+      else if (p -> is (object_kind::vector)) {
+        detail::put (sink , "(tuple");
+        open.emplace_back (p -> get <vector_t> () , 0);
+      }
+      else if (p -> is (object_kind::thunk)) {
+        detail::put (sink , "this is thunk.");
+      }
+      else if (p -> is_undefined ()) {
+        detail::put (sink , "undefined");
+      }
+      else {
+        detail::put (sink , "this is closure.");
+      }
+      // 次に書く要素を探す. 書き終えたベクタは閉じる
+      p = nullptr;
+      while (! p && ! open.empty ()) {
+        auto & top = open.back ();
+        if (top.second < top.first -> size ()) {
+          detail::put (sink , " ");
+          p = & (* top.first) [top.second ++];
+        }
+        else {
+          detail::put (sink , ")");
+          open.pop_back ();
+        }
+      }
+      if (! p) {
+        return;
+      }
+    }
+  }
+
+  // 出力イテレータに書いて, 書き終えた先を返す
+  template <typename OutputIterator>
+  inline auto show_to (OutputIterator out , const value_t & v) -> decltype (* out ++ = 'c' , OutputIterator {out}) {
+    detail::iterator_sink <OutputIterator> sink {out};
+    show_to (sink , v);
+    return sink.out;
+  }
+
+  inline auto show (const value_t & v) -> std::string {
+    std::string s;
+    show_to (s , v);
+    return s;
+  }
+
+  namespace detail {
+    // 式の根のノード. 同じノードかどうかを比べたり, ノードごとの表を引いたりするのに使う
+    inline auto node_of (const expression & e) -> const object_t * {
+      return boost::apply_visitor ([] (const auto & p) -> const object_t * {
+        return p.get ();
+      } , e);
+    }
+
+    // パターンが束縛する名前
+    inline auto bound_names (const expression & pattern , std::vector <symbol> & out) -> void {
+      if (auto x = boost::get <ref <var_t>> (& pattern)) {
+        out.push_back ((* x) -> name);
+      }
+      else if (auto t = boost::get <ref <tuple_t>> (& pattern)) {
+        for (auto && e : (* t) -> elements) {
+          bound_names (e , out);
+        }
+      }
+    }
+
+    // e の自由変数を top に足す (重複あり). ラムダの中には入らず, 作ったときに求めた free を使う.
+    // 入れ子が深くてもネイティブスタックを使わないよう, 明示的なスタックで辿る.
+    inline auto analyze (const expression & e , std::vector <symbol> & top) -> void {
+      // hide があれば name を束縛する式の子を辿り終えたところ.
+      // e も hide も無ければ name を束縛する式の子を辿り始めるところ
+      struct task {
+        const expression * e;
+        bool hide;
+        symbol name;
+      };
+      auto visit = [] (const expression & x) {
+        return task {& x , false , symbol {}};
+      };
+      auto hiding = [] (symbol x) {
+        return task {nullptr , true , x};
+      };
+      auto opening = [] {
+        return task {nullptr , false , symbol {}};
+      };
+      std::vector <task> tasks {visit (e)};
+      std::vector <std::vector <symbol>> acc;
+      auto add = [&] (symbol x) {
+        (acc.empty () ? top : acc.back ()).push_back (x);
+      };
+      auto enter = [&] (const lambda_t * l) {
+        for (auto y : l -> free) {
+          add (y);
+        }
+      };
+      while (! tasks.empty ()) {
+        auto t = tasks.back ();
+        tasks.pop_back ();
+        if (! t.e && ! t.hide) {
+          acc.emplace_back ();
+        }
+        else if (t.hide) {
+          auto fv = std::move (acc.back ());
+          acc.pop_back ();
+          for (auto x : fv) {
+            if (x != t.name) {
+              add (x);
+            }
+          }
+        }
+        else if (auto x = boost::get <ref <var_t>> (t.e)) {
+          add ((* x) -> name);
+        }
+        else if (auto l = boost::get <ref <lambda_t>> (t.e)) {
+          enter (l -> get ());
+        }
+        else if (auto a = boost::get <ref <apply_t>> (t.e)) {
+          tasks.push_back (visit ((* a) -> expr));
+          tasks.push_back (visit ((* a) -> func));
+        }
+        else if (auto r = boost::get <ref <letrec_t>> (t.e)) {
+          tasks.push_back (hiding ((* r) -> name));
+          tasks.push_back (visit ((* r) -> body));
+          acc.emplace_back ();
+          enter ((* r) -> func.get ());
+        }
+        else if (auto o = boost::get <ref <prim_t>> (t.e)) {
+          tasks.push_back (visit ((* o) -> rhs));
+          tasks.push_back (visit ((* o) -> lhs));
+        }
+        else if (auto i = boost::get <ref <if_t>> (t.e)) {
+          tasks.push_back (visit ((* i) -> alternative));
+          tasks.push_back (visit ((* i) -> consequent));
+          tasks.push_back (visit ((* i) -> test));
+        }
+        else if (auto m = boost::get <ref <match_t>> (t.e)) {
+          for (std::uint32_t j = 0; j < (* m) -> clauses.size (); ++ j) {
+            if (auto x = (* m) -> binder (j)) {
+              tasks.push_back (hiding (x -> name));
+              tasks.push_back (visit ((* m) -> clauses [j].body));
+              tasks.push_back (opening ());
+            }
+            else {
+              tasks.push_back (visit ((* m) -> clauses [j].body));
+            }
+          }
+          tasks.push_back (visit ((* m) -> scrutinee));
+        }
+        else if (auto u = boost::get <ref <tuple_t>> (t.e)) {
+          for (auto j = (* u) -> elements.size (); j -- > 0;) {
+            tasks.push_back (visit ((* u) -> elements [j]));
+          }
+        }
+      }
+    }
+
+    // 本体は先に作られているので, 中のラムダの free はもう求まっている
+    inline auto free_of (const expression & arg , const expression & body) -> std::vector <symbol> {
+      std::vector <symbol> fv;
+      analyze (body , fv);
+      std::vector <symbol> bound;
+      bound_names (arg , bound);
+      fv.erase (std::remove_if (fv.begin () , fv.end () , [&] (symbol x) {
+        return std::find (bound.begin () , bound.end () , x) != bound.end ();
+      }) , fv.end ());
+      std::sort (fv.begin () , fv.end () , symbol_less);
+      fv.erase (std::unique (fv.begin () , fv.end ()) , fv.end ());
+      return fv;
+    }
+  }
+}
+
+#endif // PRO_HPP